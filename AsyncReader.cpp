@@ -0,0 +1,277 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "AsyncReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+DEFINE_int32(read_block_size, 4 << 20,
+             "bytes per read of the data files");
+
+DEFINE_int32(read_queue_depth, 16,
+             "number of reads of the data files kept in flight");
+
+namespace boosting {
+
+using namespace std;
+
+AsyncReader::AsyncReader(const vector<string>& files)
+  : curBlock_(-1), nextBlock_(0), pos_(NULL), end_(NULL) {
+
+  CHECK(FLAGS_read_block_size > 0 && FLAGS_read_queue_depth > 0);
+
+  for (int i = 0; i < files.size(); i++) {
+    const int fd = open(files[i].c_str(), O_RDONLY);
+    PCHECK(fd >= 0) << "can not open " << files[i];
+    struct stat st;
+    PCHECK(fstat(fd, &st) == 0) << "can not stat " << files[i];
+    fds_.push_back(fd);
+
+    for (int64_t offset = 0; offset < st.st_size;
+         offset += FLAGS_read_block_size) {
+      blocks_.push_back(
+        Block{i, offset, min<int64_t>(FLAGS_read_block_size, st.st_size - offset)});
+    }
+  }
+
+  slots_.resize(min<int>(FLAGS_read_queue_depth, blocks_.size()));
+  for (auto& slot : slots_) {
+    slot.buf.reset(new char[FLAGS_read_block_size]);
+  }
+
+#ifdef USE_IO_URING
+  inFlight_ = 0;
+  if (!slots_.empty()) {
+    const int ret = io_uring_queue_init(slots_.size(), &ring_, 0);
+    CHECK(ret == 0) << "io_uring_queue_init failed: " << strerror(-ret);
+  }
+#else
+  stop_ = false;
+  for (int i = 0; i < slots_.size(); i++) {
+    threads_.emplace_back(&AsyncReader::ioLoop, this);
+  }
+#endif
+
+  while (nextBlock_ < slots_.size()) {
+    submit(nextBlock_, nextBlock_);
+    nextBlock_++;
+  }
+}
+
+AsyncReader::~AsyncReader() {
+#ifdef USE_IO_URING
+  // the buffers of reads in flight must outlive them
+  for (int i = 0; i < slots_.size(); i++) {
+    while (!slots_[i].ready && inFlight_ > 0) {
+      wait(i);
+    }
+  }
+  if (!slots_.empty()) {
+    io_uring_queue_exit(&ring_);
+  }
+#else
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  requestCv_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+#endif
+  for (const int fd : fds_) {
+    close(fd);
+  }
+}
+
+bool AsyncReader::getLine(string* line) {
+  line->clear();
+  while (true) {
+    if (pos_ != end_) {
+      const char* nl =
+        static_cast<const char*>(memchr(pos_, '\n', end_ - pos_));
+      if (nl != NULL) {
+        line->append(pos_, nl - pos_);
+        pos_ = nl + 1;
+        return true;
+      }
+      line->append(pos_, end_ - pos_);
+      pos_ = end_;
+    }
+
+    // the last line of a file may have no newline
+    const bool endOfFile = curBlock_ >= 0
+      && (curBlock_ + 1 == blocks_.size()
+          || blocks_[curBlock_ + 1].fileIdx != blocks_[curBlock_].fileIdx);
+    if (endOfFile && !line->empty()) {
+      return true;
+    }
+
+    if (!advance()) {
+      return false;
+    }
+  }
+}
+
+bool AsyncReader::advance() {
+  if (curBlock_ >= 0 && nextBlock_ < blocks_.size()) {
+    // the slot of the consumed block is free
+    submit(curBlock_ % slots_.size(), nextBlock_);
+    nextBlock_++;
+  }
+
+  if (curBlock_ + 1 >= static_cast<int>(blocks_.size())) {
+    pos_ = end_ = NULL;
+    return false;
+  }
+
+  curBlock_++;
+  const int slotIdx = curBlock_ % slots_.size();
+  wait(slotIdx);
+  const Slot& slot = slots_[slotIdx];
+  CHECK(slot.block == curBlock_);
+  CHECK(slot.bytes == blocks_[curBlock_].size)
+    << "short read, file changed while reading";
+  pos_ = slot.buf.get();
+  end_ = pos_ + slot.bytes;
+  return true;
+}
+
+#ifdef USE_IO_URING
+
+void AsyncReader::prepRead(int slotIdx) {
+  Slot& slot = slots_[slotIdx];
+  const Block& block = blocks_[slot.block];
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  CHECK(sqe != NULL) << "io_uring submission queue full";
+  io_uring_prep_read(sqe, fds_[block.fileIdx], slot.buf.get() + slot.bytes,
+                     block.size - slot.bytes, block.offset + slot.bytes);
+  io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(intptr_t(slotIdx)));
+  const int ret = io_uring_submit(&ring_);
+  CHECK(ret >= 0) << "io_uring_submit failed: " << strerror(-ret);
+  inFlight_++;
+}
+
+void AsyncReader::submit(int slotIdx, int block) {
+  Slot& slot = slots_[slotIdx];
+  slot.block = block;
+  slot.bytes = 0;
+  slot.ready = false;
+  prepRead(slotIdx);
+}
+
+void AsyncReader::wait(int slotIdx) {
+  // completions come in any order, record them until slotIdx's
+  while (!slots_[slotIdx].ready) {
+    io_uring_cqe* cqe;
+    int ret;
+    do {
+      ret = io_uring_wait_cqe(&ring_, &cqe);
+    } while (ret == -EINTR);
+    CHECK(ret == 0) << "io_uring_wait_cqe failed: " << strerror(-ret);
+
+    const int idx = intptr_t(io_uring_cqe_get_data(cqe));
+    const int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+    inFlight_--;
+
+    Slot& slot = slots_[idx];
+    if (res == -EINTR || res == -EAGAIN) {
+      prepRead(idx);
+      continue;
+    }
+    CHECK(res >= 0) << "read failed: " << strerror(-res);
+    slot.bytes += res;
+    if (res > 0 && slot.bytes < blocks_[slot.block].size) {
+      prepRead(idx);
+    } else {
+      slot.ready = true;
+    }
+  }
+}
+
+#else
+
+void AsyncReader::submit(int slotIdx, int block) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    Slot& slot = slots_[slotIdx];
+    slot.block = block;
+    slot.bytes = 0;
+    slot.ready = false;
+    requests_.push_back(slotIdx);
+  }
+  requestCv_.notify_one();
+}
+
+void AsyncReader::wait(int slotIdx) {
+  unique_lock<mutex> lock(mutex_);
+  readyCv_.wait(lock, [this, slotIdx]() { return slots_[slotIdx].ready; });
+}
+
+void AsyncReader::ioLoop() {
+  while (true) {
+    int slotIdx;
+    {
+      unique_lock<mutex> lock(mutex_);
+      requestCv_.wait(lock, [this]() { return stop_ || !requests_.empty(); });
+      if (stop_) {
+        return;
+      }
+      slotIdx = requests_.front();
+      requests_.pop_front();
+    }
+
+    // slots_[slotIdx] belongs to this thread until ready
+    Slot& slot = slots_[slotIdx];
+    const Block& block = blocks_[slot.block];
+    int64_t bytes = 0;
+    while (bytes < block.size) {
+      const ssize_t n = pread(fds_[block.fileIdx], slot.buf.get() + bytes,
+                              block.size - bytes, block.offset + bytes);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      PCHECK(n >= 0) << "read failed";
+      if (n == 0) {
+        break;
+      }
+      bytes += n;
+    }
+
+    {
+      lock_guard<mutex> lock(mutex_);
+      slot.bytes = bytes;
+      slot.ready = true;
+    }
+    readyCv_.notify_all();
+  }
+}
+
+#endif
+
+}
@@ -0,0 +1,102 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_IO_URING
+#include <liburing.h>
+#else
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace boosting {
+
+// Reads a list of files as one stream of lines, like getline over each file
+// in turn, while keeping up to read_queue_depth reads of read_block_size
+// bytes in flight ahead of the consumer, across file boundaries. Built with
+// USE_IO_URING, the reads are submitted to an io_uring; otherwise they are
+// done with pread by a pool of I/O threads of the reader's own, so that
+// they never wait behind parsing work in Concurrency::threadManager.
+class AsyncReader {
+ public:
+  explicit AsyncReader(const std::vector<std::string>& files);
+
+  // Read the next line, without its newline, false after the last one
+  bool getLine(std::string* line);
+
+  ~AsyncReader();
+
+ private:
+  struct Block {
+    int fileIdx;
+    int64_t offset;
+    int64_t size;
+  };
+
+  struct Slot {
+    std::unique_ptr<char[]> buf;
+    int block;      // index of the block read into buf
+    int64_t bytes;  // bytes read so far
+    bool ready;     // whether the read is complete
+  };
+
+  // start reading block into slots_[slotIdx]
+  void submit(int slotIdx, int block);
+
+  // wait for the read into slots_[slotIdx] to complete
+  void wait(int slotIdx);
+
+  // move on to the next block, false if there is none
+  bool advance();
+
+  std::vector<int> fds_;
+  std::vector<Block> blocks_;
+  std::vector<Slot> slots_;
+
+  int curBlock_;     // block being consumed, slots_[curBlock_ % #slots]
+  int nextBlock_;    // next block to submit
+  const char* pos_;  // unconsumed part of the current block
+  const char* end_;
+
+#ifdef USE_IO_URING
+  void prepRead(int slotIdx);
+
+  io_uring ring_;
+  int inFlight_;
+#else
+  void ioLoop();
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable requestCv_;
+  std::condition_variable readyCv_;
+  std::deque<int> requests_;  // slots to read into
+  bool stop_;
+#endif
+};
+
+}
@@ -0,0 +1,194 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "BinaryData.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace boosting {
+
+using namespace std;
+
+static const char kMagic[] = "GBMD";
+static const uint32_t kVersion = 1;
+static const size_t kFileBufferSize = 4 << 20;
+
+static bool isLittleEndian() {
+  const uint32_t one = 1;
+  return *reinterpret_cast<const uint8_t*>(&one) == 1;
+}
+
+template <class T> static void writeValue(FILE* fp, const T& v) {
+  fwrite(&v, sizeof(T), 1, fp);
+}
+
+template <class T> static bool readValue(FILE* fp, T* v) {
+  return fread(v, sizeof(T), 1, fp) == 1;
+}
+
+bool isBinaryDataFile(const string& fileName) {
+  FILE* fp = fopen(fileName.c_str(), "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  char magic[4];
+  const bool binary = fread(magic, 1, 4, fp) == 4
+    && memcmp(magic, kMagic, 4) == 0;
+  fclose(fp);
+  return binary;
+}
+
+BinaryDataWriter::BinaryDataWriter(const string& fileName,
+                                   const vector<string>& columnNames,
+                                   const vector<bool>& float32,
+                                   int blockSize)
+  : float32_(float32), blockSize_(blockSize), numRows_(0),
+    columns_(columnNames.size()) {
+
+  CHECK(isLittleEndian()) << "binary data files are little-endian";
+  CHECK(float32_.size() == columnNames.size());
+  fp_ = fopen(fileName.c_str(), "wb");
+  PCHECK(fp_ != NULL) << "can not open " << fileName;
+  setvbuf(fp_, NULL, _IOFBF, kFileBufferSize);
+
+  fwrite(kMagic, 1, 4, fp_);
+  writeValue<uint32_t>(fp_, kVersion);
+  writeValue<uint32_t>(fp_, columnNames.size());
+  for (int c = 0; c < columnNames.size(); c++) {
+    writeValue<uint32_t>(fp_, columnNames[c].size());
+    fwrite(columnNames[c].data(), 1, columnNames[c].size(), fp_);
+    writeValue<uint8_t>(fp_, float32_[c] ? sizeof(float) : sizeof(double));
+  }
+  for (auto& column : columns_) {
+    column.reserve(blockSize_);
+  }
+}
+
+void BinaryDataWriter::addRow(const double* values) {
+  for (int c = 0; c < columns_.size(); c++) {
+    columns_[c].push_back(values[c]);
+  }
+  if (++numRows_ == blockSize_) {
+    writeBlock();
+  }
+}
+
+// a short write fails here rather than leave a truncated file; the header
+// writes are covered by the ferror check on close
+void BinaryDataWriter::writeBlock() {
+  writeValue<uint32_t>(fp_, numRows_);
+  for (int c = 0; c < columns_.size(); c++) {
+    const vector<double>& column = columns_[c];
+    if (float32_[c]) {
+      buf_.resize(numRows_ * sizeof(float));
+      float* out = reinterpret_cast<float*>(buf_.data());
+      for (int r = 0; r < numRows_; r++) {
+        out[r] = column[r];
+      }
+      PCHECK(fwrite(buf_.data(), 1, buf_.size(), fp_) == buf_.size())
+        << "can not write binary data file";
+    } else {
+      PCHECK(fwrite(column.data(), sizeof(double), numRows_, fp_) == numRows_)
+        << "can not write binary data file";
+    }
+    columns_[c].clear();
+  }
+  numRows_ = 0;
+}
+
+BinaryDataWriter::~BinaryDataWriter() {
+  if (numRows_ > 0) {
+    writeBlock();
+  }
+  PCHECK(!ferror(fp_) && fclose(fp_) == 0)
+    << "can not write binary data file";
+}
+
+BinaryDataReader::BinaryDataReader(const string& fileName)
+  : fileName_(fileName) {
+
+  CHECK(isLittleEndian()) << "binary data files are little-endian";
+  fp_ = fopen(fileName.c_str(), "rb");
+  PCHECK(fp_ != NULL) << "can not open " << fileName;
+  setvbuf(fp_, NULL, _IOFBF, kFileBufferSize);
+
+  char magic[4];
+  uint32_t version, numColumns;
+  CHECK(fread(magic, 1, 4, fp_) == 4 && memcmp(magic, kMagic, 4) == 0
+        && readValue(fp_, &version) && readValue(fp_, &numColumns))
+    << "not a binary data file: " << fileName;
+  CHECK(version == kVersion) << "unsupported binary data version "
+                             << version << " of " << fileName;
+  for (int c = 0; c < numColumns; c++) {
+    uint32_t length;
+    uint8_t valueSize;
+    CHECK(readValue(fp_, &length)) << "truncated header of " << fileName;
+    string name(length, '\0');
+    CHECK(fread(&name[0], 1, length, fp_) == length
+          && readValue(fp_, &valueSize)) << "truncated header of " << fileName;
+    CHECK(valueSize == sizeof(float) || valueSize == sizeof(double))
+      << "invalid value size of column " << name << " of " << fileName;
+    columnNames_.push_back(name);
+    valueSizes_.push_back(valueSize);
+  }
+}
+
+BinaryDataReader::~BinaryDataReader() {
+  fclose(fp_);
+}
+
+bool BinaryDataReader::readBlock(const vector<int>& columns,
+                                 vector<vector<double>>* values) {
+  uint32_t numRows;
+  if (!readValue(fp_, &numRows)) {
+    return false;
+  }
+  values->resize(columns.size());
+  for (int c = 0; c < columnNames_.size(); c++) {
+    const size_t bytes = size_t(numRows) * valueSizes_[c];
+    if (find(columns.begin(), columns.end(), c) == columns.end()) {
+      PCHECK(fseek(fp_, bytes, SEEK_CUR) == 0)
+        << "truncated block in " << fileName_;
+      continue;
+    }
+
+    buf_.resize(bytes);
+    CHECK(fread(buf_.data(), 1, bytes, fp_) == bytes)
+      << "truncated block in " << fileName_;
+    for (int i = 0; i < columns.size(); i++) {
+      if (columns[i] != c) {
+        continue;
+      }
+      vector<double>& out = (*values)[i];
+      out.resize(numRows);
+      if (valueSizes_[c] == sizeof(float)) {
+        const float* in = reinterpret_cast<const float*>(buf_.data());
+        copy(in, in + numRows, out.begin());
+      } else {
+        memcpy(out.data(), buf_.data(), bytes);
+      }
+    }
+  }
+  return true;
+}
+
+}
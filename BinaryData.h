@@ -0,0 +1,89 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace boosting {
+
+// Binary data files, read without any text parsing: a header naming the
+// columns, matched by name to Config::getColumnNames(), then blocks of
+// rows stored column by column. Little-endian:
+//   "GBMD", uint32 version, uint32 #columns, per column: uint32 length and
+//   name, uint8 value size (4 for float32, 8 for float64); then blocks up
+//   to the end of the file, each a uint32 #rows n followed by the n values
+//   of each column in turn
+bool isBinaryDataFile(const std::string& fileName);
+
+class BinaryDataWriter {
+ public:
+  // columns whose float32 flag is set are written as float32, the others
+  // as float64
+  BinaryDataWriter(const std::string& fileName,
+                   const std::vector<std::string>& columnNames,
+                   const std::vector<bool>& float32,
+                   int blockSize);
+
+  // values of the row, one per column
+  void addRow(const double* values);
+
+  // writes the last block
+  ~BinaryDataWriter();
+
+ private:
+  void writeBlock();
+
+  FILE* fp_;
+  const std::vector<bool> float32_;
+  const int blockSize_;
+  int numRows_;
+  // the values of the block so far, column by column
+  std::vector<std::vector<double>> columns_;
+  std::vector<char> buf_;
+};
+
+class BinaryDataReader {
+ public:
+  explicit BinaryDataReader(const std::string& fileName);
+
+  ~BinaryDataReader();
+
+  const std::vector<std::string>& getColumnNames() const {
+    return columnNames_;
+  }
+
+  // read the next block, values[i][r] being the value of row r for the
+  // column columns[i]; the other columns are skipped. False at the end of
+  // the file
+  bool readBlock(const std::vector<int>& columns,
+                 std::vector<std::vector<double>>* values);
+
+ private:
+  FILE* fp_;
+  const std::string fileName_;
+  std::vector<std::string> columnNames_;
+  std::vector<int> valueSizes_;
+  std::vector<char> buf_;
+};
+
+}
@@ -0,0 +1,75 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "Cascade.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace boosting {
+
+using namespace std;
+
+Cascade::Cascade(const vector<TreeNode<double>*>& model, double threshold)
+  : minRest_(model.size() + 1, 0.0), maxRest_(model.size() + 1, 0.0),
+    absRest_(model.size() + 1, 0.0), threshold_(threshold) {
+
+  for (const auto& t : model) {
+    trees_.emplace_back(t);
+  }
+
+  for (int i = trees_.size() - 1; i >= 0; i--) {
+    double minVote = numeric_limits<double>::max();
+    double maxVote = numeric_limits<double>::lowest();
+    for (const auto& node : trees_[i].getNodes()) {
+      if (node.fid < 0) {
+        minVote = min(minVote, node.vote);
+        maxVote = max(maxVote, node.vote);
+      }
+    }
+    minRest_[i] = minRest_[i + 1] + minVote;
+    maxRest_[i] = maxRest_[i + 1] + maxVote;
+    absRest_[i] = absRest_[i + 1] + max(fabs(minVote), fabs(maxVote));
+  }
+}
+
+bool Cascade::decide(const double* fvec, int* numTrees) const {
+  // the bounds are summed in another order than the score, so a row only
+  // stops early clear of the threshold by more than the rounding error of
+  // either sum; rows closer to it go through all the trees
+  const double eps = (trees_.size() + 2) * numeric_limits<double>::epsilon();
+  double f = 0.0;
+  for (int i = 0; i < trees_.size(); i++) {
+    f += trees_[i].eval(fvec);
+    const double margin = eps * (fabs(f) + absRest_[i + 1]);
+    if (f + minRest_[i + 1] > threshold_ + margin) {
+      *numTrees = i + 1;
+      return true;
+    }
+    if (f + maxRest_[i + 1] <= threshold_ - margin) {
+      *numTrees = i + 1;
+      return false;
+    }
+  }
+  *numTrees = trees_.size();
+  return f > threshold_;
+}
+
+}
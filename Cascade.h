@@ -0,0 +1,50 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "Tree.h"
+
+namespace boosting {
+
+// Decides whether the score of a row exceeds a threshold, evaluating as
+// few trees as needed: the remaining trees add at least the sum of their
+// minimum leaf votes and at most the sum of their maximum ones, so a row
+// stops as soon as neither can bring its score across the threshold.
+class Cascade {
+ public:
+  Cascade(const std::vector<TreeNode<double>*>& model, double threshold);
+
+  // whether the score of fvec exceeds the threshold, with the number of
+  // trees evaluated to know it
+  bool decide(const double* fvec, int* numTrees) const;
+
+ private:
+  std::vector<FlatTree<double>> trees_;
+  // sums of the minimum and maximum leaf votes of trees i and after
+  std::vector<double> minRest_;
+  std::vector<double> maxRest_;
+  // sums of the largest absolute leaf votes, bounding the rounding error
+  std::vector<double> absRest_;
+  const double threshold_;
+};
+
+}
@@ -19,6 +19,9 @@
 
 #include "Concurrency.h"
 
+#include <algorithm>
+#include <vector>
+
 DEFINE_int32(num_threads, 0,
              "number of threads to use in loading & evaluation");
 
@@ -54,4 +57,88 @@ int CounterMonitor::wait() {
   return monitor_.waitForever();
 }
 
+// runs the blocks workIdx, workIdx + totalWorkers, ...
+class ParallelBlocks : public Runnable {
+ public:
+  ParallelBlocks(
+    CounterMonitor& monitor,
+    const std::function<void(int, int, int)>& f,
+    const std::vector<int>& boundaries,
+    const int workIdx,
+    const int totalWorkers)
+    : monitor_(monitor), f_(f), boundaries_(boundaries),
+      workIdx_(workIdx), totalWorkers_(totalWorkers) {
+  }
+
+  void run() {
+    const int numBlocks = int(boundaries_.size()) - 1;
+    for (int b = workIdx_; b < numBlocks; b += totalWorkers_) {
+      f_(b, boundaries_[b], boundaries_[b + 1]);
+    }
+    monitor_.decrement();
+  }
+
+ private:
+  CounterMonitor& monitor_;
+  const std::function<void(int, int, int)>& f_;
+  const std::vector<int>& boundaries_;
+  const int workIdx_;
+  const int totalWorkers_;
+};
+
+void parallelForBlocks(const std::vector<int>& boundaries,
+                       const std::function<void(int, int, int)>& f) {
+  const int numBlocks = std::max(0, int(boundaries.size()) - 1);
+  const int numWorkers = std::min(FLAGS_num_threads, numBlocks);
+  if (numWorkers > 1) {
+    CounterMonitor monitor(numWorkers);
+    for (int wid = 0; wid < numWorkers; wid++) {
+      Concurrency::threadManager->add(
+        boost::shared_ptr<Runnable>(
+          new ParallelBlocks(monitor, f, boundaries, wid, numWorkers)));
+    }
+    monitor.wait();
+  } else {
+    for (int b = 0; b < numBlocks; b++) {
+      f(b, boundaries[b], boundaries[b + 1]);
+    }
+  }
+}
+
+void parallelForBlocks(int size,
+                       int blockSize,
+                       const std::function<void(int, int, int)>& f) {
+  std::vector<int> boundaries;
+  for (int begin = 0; begin < size; begin += blockSize) {
+    boundaries.push_back(begin);
+  }
+  boundaries.push_back(size);
+  parallelForBlocks(boundaries, f);
+}
+
+double parallelBlockSum(const std::vector<int>& boundaries,
+                        const std::function<double(int, int)>& f) {
+  std::vector<double> blockSums(std::max<int>(0, boundaries.size() - 1), 0.0);
+  parallelForBlocks(boundaries, [&](int b, int begin, int end) {
+      blockSums[b] = f(begin, end);
+    });
+
+  double sum = 0.0;
+  for (const double s : blockSums) {
+    sum += s;
+  }
+  return sum;
+}
+
+double parallelBlockSum(int size,
+                        int blockSize,
+                        const std::function<double(int, int)>& f) {
+  std::vector<int> boundaries;
+  for (int begin = 0; begin < size; begin += blockSize) {
+    boundaries.push_back(begin);
+  }
+  boundaries.push_back(size);
+  return parallelBlockSum(boundaries, f);
+}
+
 };
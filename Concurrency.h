@@ -20,6 +20,8 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
+#include <vector>
 #include "thrift/concurrency/Monitor.h"
 #include "thrift/concurrency/PosixThreadFactory.h"
 #include "thrift/concurrency/ThreadManager.h"
@@ -60,4 +62,24 @@ class CounterMonitor {
 
 };
 
+// Call f(block, begin, end) for each block [begin, end) of blockSize
+// elements of [0, size), on num_threads threads if num_threads > 1.
+void parallelForBlocks(int size,
+                       int blockSize,
+                       const std::function<void(int, int, int)>& f);
+
+// Same for the blocks [boundaries[b], boundaries[b + 1]).
+void parallelForBlocks(const std::vector<int>& boundaries,
+                       const std::function<void(int, int, int)>& f);
+
+// Sum of f(begin, end) over the blocks of [0, size), computed as above but
+// added up in block order: the blocks, hence the sum, to the last bit, do
+// not depend on the number of threads.
+double parallelBlockSum(int size,
+                        int blockSize,
+                        const std::function<double(int, int)>& f);
+
+double parallelBlockSum(const std::vector<int>& boundaries,
+                        const std::function<double(int, int)>& f);
+
 }
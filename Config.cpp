@@ -63,19 +63,79 @@ bool Config::readConfig(const std::string& fileName) {
     cmpIdx_ = (it != cfg.items().end())
       ? columnIdx[it->second.asString()] : -1;
 
+    it = cfg.find("input_format");
+    const string format = (it != cfg.items().end())
+      ? it->second.asString().toStdString() : "";
+    inputFormat_ = (format == "libsvm") ? LibSvmText : DelimitedText;
+
+    it = cfg.find("query_column");
+    queryIdx_ = (it != cfg.items().end())
+      ? columnIdx.at(it->second.asString()) : -1;
+
     it = cfg.find("loss_function");
-    if (it != cfg.items().end() && it->second.asString() == "logistic") {
+    const string loss = (it != cfg.items().end())
+      ? it->second.asString().toStdString() : "";
+    if (loss == "logistic") {
       lossFunction_ = L2Logistic;
+    } else if (loss == "quantile") {
+      lossFunction_ = QuantileRegression;
+    } else if (loss == "huber") {
+      lossFunction_ = HuberRegression;
+    } else if (loss == "lambdarank") {
+      lossFunction_ = LambdaRank;
+      CHECK(queryIdx_ >= 0 || inputFormat_ == LibSvmText)
+        << "lambdarank needs a query_column";
     } else {
       lossFunction_ = L2Regression;
     }
 
+    it = cfg.find("quantile_alpha");
+    quantileAlpha_ = (it != cfg.items().end()) ? it->second.asDouble() : 0.5;
+    CHECK(quantileAlpha_ > 0.0 && quantileAlpha_ < 1.0)
+      << "quantile_alpha must be in (0, 1)";
+
+    it = cfg.find("huber_delta");
+    huberDelta_ = (it != cfg.items().end()) ? it->second.asDouble() : 1.0;
+    CHECK(huberDelta_ > 0.0) << "huber_delta must be positive";
+
     const dynamic& trainColumns = cfg["train_columns"];
     for (auto it = trainColumns.begin(); it != trainColumns.end(); ++it) {
       featureToIndexMap_[it->asString().toStdString()] = trainIdx_.size();
       trainIdx_.push_back(columnIdx.at(it->asString()));
     }
 
+    // optional serving cost of features, as a map from feature name to the
+    // loss reduction per example a split needs to start using the feature
+    featureCosts_.assign(trainIdx_.size(), 0.0);
+    it = cfg.find("feature_costs");
+    if (it != cfg.items().end()) {
+      for (const auto& kv : it->second.items()) {
+        const string feature = kv.first.asString().toStdString();
+        const int fidx = getFeatureIndex(feature);
+        CHECK(fidx >= 0) << "unknown feature in feature_costs: " << feature;
+        featureCosts_[fidx] = kv.second.asDouble();
+      }
+    }
+
+    it = cfg.find("feature_cost_scope");
+    featureCostPerTree_ = (it != cfg.items().end())
+      && it->second.asString() == "tree";
+
+    categorical_.assign(trainIdx_.size(), false);
+    it = cfg.find("categorical_columns");
+    if (it != cfg.items().end()) {
+      for (const auto& column : it->second) {
+        const string feature = column.asString().toStdString();
+        const int fidx = getFeatureIndex(feature);
+        CHECK(fidx >= 0) << "unknown feature in categorical_columns: "
+                         << feature;
+        categorical_[fidx] = true;
+      }
+    }
+
+    it = cfg.find("missing_values");
+    missingValues_ = (it != cfg.items().end()) && it->second.asBool();
+
     const dynamic& weakColumns = cfg["weak_columns"];
     for (auto it = weakColumns.begin(); it != weakColumns.end(); ++it) {
       weakIdx_.push_back(columnIdx.at(it->asString()));
@@ -27,8 +27,19 @@
 namespace boosting {
 
 enum LossFunction {
-  L2Regression = 0,
-  L2Logistic   = 1
+  L2Regression       = 0,
+  L2Logistic         = 1,
+  QuantileRegression = 2,
+  HuberRegression    = 3,
+  LambdaRank         = 4
+};
+
+enum InputFormat {
+  // a field per column, separated by the delimiter
+  DelimitedText = 0,
+  // LibSVM lines "label [qid:query] index:value ...", index being that of
+  // a column, and absent columns 0; the qid is required with queries
+  LibSvmText    = 1
 };
 
 // Specifying the training parameters and data format
@@ -70,6 +81,18 @@ struct Config {
     return cmpIdx_;
   }
 
+  // column of the query ids, the rows of a query being contiguous in the
+  // data; -1 if not specified
+  int getQueryIdx() const {
+    return queryIdx_;
+  }
+
+  // whether the rows are grouped in queries, by the query column or the
+  // qid of LibSVM lines
+  bool hasQueries() const {
+    return queryIdx_ != -1 || lossFunction_ == LambdaRank;
+  }
+
   const std::vector<int>& getTrainIdx() const {
     return trainIdx_;
   }
@@ -105,10 +128,47 @@ struct Config {
     return delimiter_;
   }
 
+  InputFormat getInputFormat() const {
+    return inputFormat_;
+  }
+
   LossFunction getLossFunction() const {
     return lossFunction_;
   }
 
+  // quantile predicted with QuantileRegression, 0.5 if not specified
+  double getQuantileAlpha() const {
+    return quantileAlpha_;
+  }
+
+  // residual beyond which the HuberRegression loss is linear, 1.0 if not
+  // specified
+  double getHuberDelta() const {
+    return huberDelta_;
+  }
+
+  // cost of computing the feature at serving time, 0 if not specified
+  double getFeatureCost(const int fidx) const {
+    return featureCosts_[fidx];
+  }
+
+  // whether a feature cost is paid once per tree, rather than once per model
+  bool isFeatureCostPerTree() const {
+    return featureCostPerTree_;
+  }
+
+  // whether empty or unparsable feature fields are read as missing (NaN),
+  // rather than as 0
+  bool hasMissingValues() const {
+    return missingValues_;
+  }
+
+  // whether the values of the feature are category ids, split on by
+  // sets of categories rather than by thresholds
+  bool isCategoricalFeature(const int fidx) const {
+    return categorical_[fidx];
+  }
+
  private:
 
   int numTrees_;
@@ -119,15 +179,24 @@ struct Config {
 
   int targetIdx_;
   int cmpIdx_;
+  int queryIdx_;
   LossFunction lossFunction_;
+  double quantileAlpha_;
+  double huberDelta_;
 
   std::vector<int> trainIdx_;
   std::vector<int> weakIdx_;
   std::vector<int> evalIdx_;
 
+  std::vector<double> featureCosts_;
+  bool featureCostPerTree_;
+  bool missingValues_;
+  std::vector<bool> categorical_;
+
   std::vector<std::string> allColumns_;
   std::unordered_map<std::string, int> featureToIndexMap_;
   char delimiter_;
+  InputFormat inputFormat_;
 };
 
 }
@@ -0,0 +1,139 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Converts delimited text or LibSVM data files to a binary data file (see
+// BinaryData.h), with the columns train reads: the train, target, compare
+// and query columns of the config, parsed as train would parse them.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "AsyncReader.h"
+#include "BinaryData.h"
+#include "Config.h"
+#include "DataSet.h"
+#include "gflags/gflags.h"
+#include "folly/String.h"
+#include "glog/logging.h"
+
+using namespace boosting;
+using namespace std;
+
+DEFINE_string(config_file, "",
+              "file contains the configurations");
+
+DEFINE_string(input_files, "",
+              "comma separated list of text data files to convert");
+
+DEFINE_string(output_file, "",
+              "binary data file to write");
+
+DEFINE_bool(float32, false,
+            "write the feature and compare columns as float32, halving "
+            "the file; the target and query columns stay float64");
+
+DEFINE_int32(block_rows, 65536,
+             "# of rows per block of the binary data file");
+
+int main(int argc, char **argv) {
+  google::SetUsageMessage("Convert text data files to binary");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  Config cfg;
+  CHECK(cfg.readConfig(FLAGS_config_file));
+  CHECK(!cfg.hasQueries() || cfg.getQueryIdx() != -1)
+    << "query_column names the query column of binary data files";
+  DataSet ds(cfg, -1, -1);
+
+  // the columns written, in the order of the config
+  vector<int> columns(cfg.getTrainIdx());
+  columns.push_back(cfg.getTargetIdx());
+  if (cfg.getCompareIdx() != -1) {
+    columns.push_back(cfg.getCompareIdx());
+  }
+  if (cfg.getQueryIdx() != -1) {
+    columns.push_back(cfg.getQueryIdx());
+  }
+  sort(columns.begin(), columns.end());
+  columns.erase(unique(columns.begin(), columns.end()), columns.end());
+
+  vector<string> names;
+  vector<bool> float32;
+  for (const int idx : columns) {
+    names.push_back(cfg.getColumnNames()[idx]);
+    float32.push_back(FLAGS_float32 && idx != cfg.getTargetIdx()
+                      && idx != cfg.getQueryIdx());
+  }
+
+  // where each column takes its value from: a feature, or else the target,
+  // compare value or query of the row
+  const int numFeatures = cfg.getNumFeatures();
+  vector<int> sources;
+  for (const int idx : columns) {
+    const auto& trainIdx = cfg.getTrainIdx();
+    const auto it = find(trainIdx.begin(), trainIdx.end(), idx);
+    if (it != trainIdx.end()) {
+      sources.push_back(it - trainIdx.begin());
+    } else if (idx == cfg.getTargetIdx()) {
+      sources.push_back(numFeatures);
+    } else if (idx == cfg.getCompareIdx()) {
+      sources.push_back(numFeatures + 1);
+    } else {
+      sources.push_back(numFeatures + 2);
+    }
+  }
+
+  vector<folly::StringPiece> sv;
+  folly::split(',', FLAGS_input_files, sv);
+  vector<string> files;
+  for (const auto& s : sv) {
+    files.push_back(s.str());
+  }
+  AsyncReader reader(files);
+  BinaryDataWriter writer(FLAGS_output_file, names, float32,
+                          FLAGS_block_rows);
+
+  boost::scoped_array<double> fvec(new double[numFeatures]);
+  vector<double> row(numFeatures + 3), values(columns.size());
+  string line;
+  int64_t numRows = 0, numInvalid = 0;
+  while (reader.getLine(&line)) {
+    double target, cmpValue = 0.0;
+    uint64_t query = 0;
+    if (!ds.getRow(line, &target, fvec, &cmpValue, &query)) {
+      numInvalid++;
+      continue;
+    }
+    copy(fvec.get(), fvec.get() + numFeatures, row.begin());
+    row[numFeatures] = target;
+    row[numFeatures + 1] = cmpValue;
+    // the query keys are hashes, kept to the 53 bits a double holds
+    row[numFeatures + 2] = query & ((uint64_t(1) << 53) - 1);
+    for (int c = 0; c < columns.size(); c++) {
+      values[c] = row[sources[c]];
+    }
+    writer.addRow(values.data());
+    numRows++;
+  }
+  LOG(INFO) << "converted " << numRows << " rows to " << FLAGS_output_file
+            << ", skipped " << numInvalid << " invalid rows";
+  return 0;
+}
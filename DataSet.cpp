@@ -20,8 +20,12 @@
 #include "DataSet.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <limits>
+#include <unordered_map>
 
 #include "Config.h"
 #include "Tree.h"
@@ -29,6 +33,10 @@
 #include <folly/Conv.h>
 #include <folly/String.h>
 
+DEFINE_bool(row_major_bytes, false,
+            "also keep the features stored as bytes row by row, to build "
+            "the histograms of small nodes one row at a time");
+
 namespace boosting {
 
 using namespace std;
@@ -38,19 +46,90 @@ DataSet::DataSet(const Config& cfg, int bucketingThresh, int examplesThresh)
     examplesThresh_(examplesThresh),
     preBucketing_(true), numExamples_(0),
     numFeatures_(cfg.getNumFeatures()),
-    features_(new FeatureData[numFeatures_]) {
+    features_(new FeatureData[numFeatures_]),
+    columnFeatures_(cfg.getColumnNames().size(), -1), lastQuery_(0),
+    rowByteColumns_(numFeatures_, -1), rowByteWidth_(0) {
 
   for (int i = 0; i < numFeatures_; i++) {
     features_[i].fvec.reset(new vector<double>());
     features_[i].encoding = DOUBLE;
+    features_[i].categorical = cfg.isCategoricalFeature(i);
+    features_[i].lookupMin = 0;
+    columnFeatures_[cfg.getTrainIdx()[i]] = i;
+  }
+}
+
+// the line without its end of line characters, which files with CRLF
+// line ends leave in
+static folly::StringPiece stripLineEnd(const string& line) {
+  const char* end = line.data() + line.size();
+  while (end != line.data() && (end[-1] == '\r' || end[-1] == '\n')) {
+    end--;
+  }
+  return folly::StringPiece(line.data(), end);
+}
+
+// Call f(column, value) for each index:value field of a LibSVM line, and
+// q(id) with the id of its qid field if any, stopping at the end of the
+// line, CR included, or at a comment. The label is read into *label. False if the line
+// is malformed.
+template <class F, class Q>
+static bool parseLibSvm(const string& line, double* label, F f, Q q) {
+  const char* p = line.c_str();
+  char* end;
+  *label = strtod(p, &end);
+  if (end == p) {
+    return false;
+  }
+  for (p = end; ; p = end) {
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (*p == '\0' || *p == '\r' || *p == '\n' || *p == '#') {
+      return true;
+    }
+    if (strncmp(p, "qid:", 4) == 0) {
+      const char* id = p + 4;
+      for (end = const_cast<char*>(id);
+           *end != '\0' && *end != ' ' && *end != '\t' && *end != '\r'
+             && *end != '\n'; end++) {
+      }
+      q(folly::StringPiece(id, end));
+      continue;
+    }
+    const long column = strtol(p, &end, 10);
+    if (end == p || *end != ':') {
+      return false;
+    }
+    p = end + 1;
+    const double val = strtod(p, &end);
+    if (end == p) {
+      return false;
+    }
+    f(column, val);
   }
 }
 
 bool DataSet::getEvalColumns(const std::string& line,
 			     boost::scoped_array<std::string>& feval) const {
-  vector<folly::StringPiece> sv;
-  folly::split(cfg_.getDelimiter(), line, sv);
   const auto& evalColumns = cfg_.getEvalIdx();
+  if (cfg_.getInputFormat() == LibSvmText) {
+    vector<double> values(cfg_.getColumnNames().size(), 0.0);
+    double label;
+    parseLibSvm(line, &label, [&](long column, double val) {
+        if (column >= 0 && column < values.size()) {
+          values[column] = val;
+        }
+      }, [](folly::StringPiece id) {});
+    values[cfg_.getTargetIdx()] = label;
+    for (int fid = 0; fid < evalColumns.size(); fid++) {
+      feval[fid] = folly::to<string>(values[evalColumns[fid]]);
+    }
+    return true;
+  }
+
+  vector<folly::StringPiece> sv;
+  folly::split(cfg_.getDelimiter(), stripLineEnd(line), sv);
 
   for (int fid = 0; fid < evalColumns.size(); fid++) {
     feval[fid] = sv[evalColumns[fid]].toString();
@@ -58,12 +137,50 @@ bool DataSet::getEvalColumns(const std::string& line,
   return true;
 }
 
+// parse a field holding a decimal integer, false if it holds anything else
+static bool parseInteger(folly::StringPiece field, double* val) {
+  const char* p = field.begin();
+  const char* end = field.end();
+  const bool negative = (p != end && *p == '-');
+  if (p != end && (*p == '-' || *p == '+')) {
+    p++;
+  }
+  // up to 15 digits stay exact as int64_t and double
+  if (p == end || end - p > 15) {
+    return false;
+  }
+  int64_t v = 0;
+  for (; p != end; p++) {
+    const unsigned digit = *p - '0';
+    if (digit > 9) {
+      return false;
+    }
+    v = v * 10 + digit;
+  }
+  *val = negative ? -v : v;
+  return true;
+}
+
+// parse a feature field, empty or unparsable fields are missing
+static double parseFeature(const string& field) {
+  char* end;
+  const double val = strtod(field.c_str(), &end);
+  if (end == field.c_str() || *end != '\0') {
+    return numeric_limits<double>::quiet_NaN();
+  }
+  return val;
+}
+
 bool DataSet::getRow(const string& line, double* target,
                      boost::scoped_array<double>& fvec,
-                     double* cmpValue) const {
+                     double* cmpValue,
+                     uint64_t* query) const {
+  if (cfg_.getInputFormat() == LibSvmText) {
+    return getSparseRow(line, target, fvec, cmpValue, query);
+  }
   try {
     vector<folly::StringPiece> sv;
-    folly::split(cfg_.getDelimiter(), line, sv);
+    folly::split(cfg_.getDelimiter(), stripLineEnd(line), sv);
 
     if (sv.size() != cfg_.getColumnNames().size()) {
       LOG(ERROR) << "invalid row: unexpected number of columns" << line
@@ -73,16 +190,24 @@ bool DataSet::getRow(const string& line, double* target,
     }
     const auto& trainColumns = cfg_.getTrainIdx();
 
+    const bool missingValues = cfg_.hasMissingValues();
     for (int fid = 0; fid < trainColumns.size(); fid++) {
-      fvec[fid] = atof(sv[trainColumns[fid]].toString().c_str());
-    }
-    *target = atof(sv[cfg_.getTargetIdx()].toString().c_str());
-    if (cfg_.getLossFunction() == L2Logistic) {
-      *target = (*target) > 0.0 ? 1.0 : -1.0;
+      // integer features skip the float parse, falling back to it for
+      // anything else
+      if (!features_[fid].lookup.empty()
+          && parseInteger(sv[trainColumns[fid]], &fvec[fid])) {
+        continue;
+      }
+      const string field = sv[trainColumns[fid]].toString();
+      fvec[fid] = missingValues ? parseFeature(field) : atof(field.c_str());
     }
+    *target = getTarget(atof(sv[cfg_.getTargetIdx()].toString().c_str()));
     if (cfg_.getCompareIdx() != -1 && cmpValue != NULL) {
       *cmpValue = atof(sv[cfg_.getCompareIdx()].toString().c_str());
     }
+    if (cfg_.getQueryIdx() != -1 && query != NULL) {
+      *query = hash<string>()(sv[cfg_.getQueryIdx()].toString());
+    }
 
   } catch (...) {
     LOG(ERROR) << "fail to process line: " << line;
@@ -91,6 +216,57 @@ bool DataSet::getRow(const string& line, double* target,
   return true;
 }
 
+double DataSet::getTarget(double value) const {
+  if (cfg_.getLossFunction() == L2Logistic) {
+    return value > 0.0 ? 1.0 : -1.0;
+  }
+  return value;
+}
+
+bool DataSet::getSparseRow(const string& line, double* target,
+                           boost::scoped_array<double>& fvec,
+                           double* cmpValue,
+                           uint64_t* query) const {
+  fill(fvec.get(), fvec.get() + numFeatures_, 0.0);
+  const int cmpIdx = (cmpValue != NULL) ? cfg_.getCompareIdx() : -1;
+  if (cmpIdx != -1) {
+    *cmpValue = 0.0;
+  }
+  // every row sets its own query, a row without qid must not join the
+  // query of the row before it
+  bool hasQuery = false;
+  if (query != NULL) {
+    *query = 0;
+  }
+
+  const bool ok = parseLibSvm(line, target, [&](long column, double val) {
+      if (column < 0 || column >= columnFeatures_.size()) {
+        return;
+      }
+      if (columnFeatures_[column] != -1) {
+        fvec[columnFeatures_[column]] = val;
+      }
+      if (column == cmpIdx) {
+        *cmpValue = val;
+      }
+    }, [&](folly::StringPiece id) {
+      hasQuery = true;
+      if (query != NULL) {
+        *query = hash<string>()(id.str());
+      }
+    });
+  if (!ok) {
+    LOG(ERROR) << "invalid libsvm row: " << line;
+    return false;
+  }
+  if (!hasQuery && cfg_.hasQueries()) {
+    LOG(ERROR) << "libsvm row without qid: " << line;
+    return false;
+  }
+  *target = getTarget(*target);
+  return true;
+}
+
 //predict without explicitly creating feature vector, since it is
 //expensive to copy the long vector. used only in Gbm eval step.
 double DataSet::getPrediction(TreeNode<uint16_t>* rt, int eid) const {
@@ -102,11 +278,15 @@ double DataSet::getPrediction(TreeNode<uint16_t>* rt, int eid) const {
     uint16_t fv;
     if (features_[fid].encoding == BYTE) {
       fv = (*features_[fid].bvec)[eid];
+    } else if (features_[fid].encoding == PACKED) {
+      fv = (*features_[fid].pvec)[eid];
     } else {
       fv = (*features_[fid].svec)[eid];
     }
 
-    if (fv <= pnode->getFv()) {
+    if (pnode->isCategorical() ? pnode->goLeft(fv)
+        : (fv <= pnode->getFv() || (pnode->isMissingLeft()
+                                    && fv == features_[fid].getMissingBucket()))) {
       return getPrediction(pnode->getLeft(), eid);
     } else {
       return getPrediction(pnode->getRight(), eid);
@@ -119,7 +299,8 @@ double DataSet::getPrediction(TreeNode<uint16_t>* rt, int eid) const {
 }
 
 bool DataSet::addVector(const boost::scoped_array<double>& fvec,
-                        double target) {
+                        double target,
+                        uint64_t query) {
   if (examplesThresh_ != -1 && numExamples_ > examplesThresh_) {
     return false;
   }
@@ -129,25 +310,28 @@ bool DataSet::addVector(const boost::scoped_array<double>& fvec,
     if (preBucketing_) {
       features_[fid].fvec->push_back(val);
     } else {
-      const auto& transitions = features_[fid].transitions;
-      const auto& it = lower_bound(transitions.begin(),
-                                   transitions.end(),
-                                   val);
-
       if (features_[fid].encoding == EMPTY) {
         continue;
-      } else if (features_[fid].encoding == BYTE) {
-        (features_[fid].bvec)->push_back(
-          static_cast<uint8_t>(it - transitions.begin()));
+      }
+
+      const uint16_t v = features_[fid].getBucket(val);
+
+      if (features_[fid].encoding == BYTE) {
+        (features_[fid].bvec)->push_back(static_cast<uint8_t>(v));
       } else if (features_[fid].encoding == SHORT) {
-        (features_[fid].svec)->push_back(
-          static_cast<uint16_t>(it - transitions.begin()));
+        (features_[fid].svec)->push_back(v);
+      } else if (features_[fid].encoding == PACKED) {
+        (features_[fid].pvec)->push_back(v);
       } else {
         LOG(INFO) << "invalid encoding after bucketing";
       }
     }
   }
   targets_.push_back(target);
+  if (cfg_.hasQueries() && (queries_.empty() || query != lastQuery_)) {
+    queries_.push_back(numExamples_);
+    lastQuery_ = query;
+  }
   numExamples_++;
 
   if (bucketingThresh_ != -1 && numExamples_ > bucketingThresh_
@@ -167,6 +351,7 @@ struct IdVal {
 
 template<class T>
 void fillValues(const vector<IdVal>& idvals,
+                const vector<int>& missingIds,
                 const vector<int>& transitions,
                 vector<T>& vec) {
   int idx = 0;
@@ -180,6 +365,9 @@ void fillValues(const vector<IdVal>& idvals,
     vec[idvals[idx].id] = static_cast<T>(transitions.size());
     idx++;
   }
+  for (const int id : missingIds) {
+    vec[id] = static_cast<T>(transitions.size() + 1);
+  }
 }
 
 template<class T>
@@ -189,6 +377,11 @@ void check(const vector<T>& vec,
 
   CHECK(vec.size() == fvec.size());
   for (int idx = 0; idx < vec.size(); idx++) {
+    if (std::isnan(fvec[idx])) {
+      CHECK(vec[idx] == transitions.size() + 1) << "not in missing bucket";
+      continue;
+    }
+
     if (vec[idx] < transitions.size()) {
       CHECK(fvec[idx] <= transitions[vec[idx]])
         << "less or equal than transition! ";
@@ -209,16 +402,147 @@ void check(const FeatureData& fd) {
   }
 }
 
-void Bucketize(FeatureData& fd, bool useByteEncoding) {
+// pack a SHORT column whose buckets, up to the missing bucket, fit in
+// PackedVector::kMaxWidth bits
+void pack(FeatureData& fd) {
+  if (fd.encoding != SHORT) {
+    return;
+  }
+  int width = 0;
+  while ((1 << width) <= fd.getMissingBucket()) {
+    width++;
+  }
+  if (width > PackedVector::kMaxWidth) {
+    return;
+  }
+
+  fd.pvec.reset(new PackedVector(width));
+  for (const uint16_t v : *(fd.svec)) {
+    fd.pvec->push_back(v);
+  }
+  fd.encoding = PACKED;
+  fd.svec.reset();
+}
+
+// largest range of values of an integer feature with a lookup table,
+// keeping the table in cache
+const int kMaxLookupSize = 4096;
+
+// set up the lookup table of fd if all its values are integers
+// within kMaxLookupSize of each other
+void buildLookup(FeatureData& fd, const vector<double>& fv) {
+  if (fd.encoding == EMPTY) {
+    return;
+  }
+
+  double minValue = numeric_limits<double>::max();
+  double maxValue = numeric_limits<double>::lowest();
+  for (const double v : fv) {
+    if (std::isnan(v)) {
+      continue;
+    }
+    if (v != floor(v) || fabs(v) > 1e15) {
+      return;
+    }
+    minValue = min(minValue, v);
+    maxValue = max(maxValue, v);
+  }
+  if (minValue > maxValue || maxValue - minValue >= kMaxLookupSize) {
+    return;
+  }
+
+  vector<uint16_t> lookup(static_cast<int>(maxValue - minValue) + 1);
+  for (int i = 0; i < lookup.size(); i++) {
+    lookup[i] = fd.getBucket(minValue + i);
+  }
+  fd.lookupMin = static_cast<int64_t>(minValue);
+  fd.lookup.swap(lookup);
+}
+
+// category ids that get buckets of their own: non-negative integers below
+// kMaxCategory; trees keep the large ones as sorted lists, see CategorySet
+const double kMaxCategory = 1 << 20;
+
+void BucketizeCategories(FeatureData& fd, bool useByteEncoding) {
   CHECK(fd.encoding == DOUBLE) << "invalid data to bucketing";
 
   const auto& fv = *(fd.fvec);
+
+  bool hasMissing = false;
+  unordered_map<double, int> counts;
+  for (const double v : fv) {
+    if (std::isnan(v)) {
+      hasMissing = true;
+    } else if (v >= 0 && v < kMaxCategory && v == floor(v)) {
+      counts[v]++;
+    }
+  }
+
+  // keep the most frequent categories, leaving room for the buckets of
+  // other categories and of missing values
+  const int maxCategories = (useByteEncoding
+    ? numeric_limits<uint8_t>::max() : numeric_limits<uint16_t>::max()) - 1;
+  vector<pair<double, int>> categories(counts.begin(), counts.end());
+  if (categories.size() > maxCategories) {
+    nth_element(categories.begin(), categories.begin() + maxCategories,
+                categories.end(),
+                [](const pair<double, int>& x, const pair<double, int>& y) {
+                  return x.second > y.second
+                    || (x.second == y.second && x.first < y.first);
+                });
+    categories.resize(maxCategories);
+  }
+
+  for (const auto& c : categories) {
+    fd.transitions.push_back(c.first);
+  }
+  sort(fd.transitions.begin(), fd.transitions.end());
+
   const int num = fv.size();
+  if (fd.transitions.size() == 0 && !hasMissing) {
+    fd.encoding = EMPTY;
+  } else if (fd.transitions.size() < numeric_limits<uint8_t>::max()) {
+    fd.encoding = BYTE;
+    fd.bvec.reset(new vector<uint8_t>(num));
+    for (int i = 0; i < num; i++) {
+      (*fd.bvec)[i] = fd.getBucket(fv[i]);
+    }
+  } else {
+    fd.encoding = SHORT;
+    fd.svec.reset(new vector<uint16_t>(num));
+    for (int i = 0; i < num; i++) {
+      (*fd.svec)[i] = fd.getBucket(fv[i]);
+    }
+  }
+
+  pack(fd);
+  buildLookup(fd, fv);
 
+  // free up the original vector
+  fd.fvec.reset();
+}
+
+void Bucketize(FeatureData& fd, bool useByteEncoding) {
+  CHECK(fd.encoding == DOUBLE) << "invalid data to bucketing";
+
+  if (fd.categorical) {
+    BucketizeCategories(fd, useByteEncoding);
+    return;
+  }
+
+  const auto& fv = *(fd.fvec);
+
+  // missing values are left out of the buckets of transitions
   vector<IdVal> idvals;
-  for (int i = 0; i < num; i++) {
-    idvals.emplace_back(i, fv[i]);
+  vector<int> missingIds;
+  for (int i = 0; i < fv.size(); i++) {
+    if (std::isnan(fv[i])) {
+      missingIds.push_back(i);
+    } else {
+      idvals.emplace_back(i, fv[i]);
+    }
   }
+  const int num = idvals.size();
 
   sort(idvals.begin(), idvals.end(),
        [](const IdVal& x, const IdVal& y) {
@@ -228,7 +552,7 @@ void Bucketize(FeatureData& fd, bool useByteEncoding) {
   uint16_t maxValue
     = useByteEncoding ? numeric_limits<uint8_t>::max() : numeric_limits<uint16_t>::max();
 
-  const int stepSize = ceil(fv.size()/(1.0 + maxValue));
+  const int stepSize = ceil(num/(1.0 + maxValue));
 
   vector<int> transitions;
   int i = stepSize;
@@ -251,20 +575,24 @@ void Bucketize(FeatureData& fd, bool useByteEncoding) {
   }
 
   bool byteEncoding = (transitions.size() < numeric_limits<uint8_t>::max());
-  if (transitions.size() == 0) {
+  // a feature with a single value may still split on being missing
+  if (transitions.size() == 0 && missingIds.empty()) {
     fd.encoding = EMPTY;
   } else if (byteEncoding) {
     fd.encoding = BYTE;
-    fd.bvec.reset(new vector<uint8_t>(num));
-    fillValues<uint8_t>(idvals, transitions, *(fd.bvec));
+    fd.bvec.reset(new vector<uint8_t>(fv.size()));
+    fillValues<uint8_t>(idvals, missingIds, transitions, *(fd.bvec));
   } else {
     fd.encoding = SHORT;
-    fd.svec.reset(new vector<uint16_t>(num));
-    fillValues<uint16_t>(idvals, transitions, *(fd.svec));
+    fd.svec.reset(new vector<uint16_t>(fv.size()));
+    fillValues<uint16_t>(idvals, missingIds, transitions, *(fd.svec));
   }
 
   check(fd);
 
+  pack(fd);
+  buildLookup(fd, *(fd.fvec));
+
   // free up the original vector
   fd.fvec.reset();
 }
@@ -275,23 +603,56 @@ void DataSet::bucketize() {
   }
 
   LOG(INFO) << "start bucketization for data compression";
-  int hist[4];
+  int hist[5];
   memset(hist, 0, sizeof(hist));
+  double packedShorts = 0.0;  // size of the packed columns in shorts
 
   for (int i = 0; i < numFeatures_; i++) {
     Bucketize(features_[i], cfg_.isWeakFeature(i));
     hist[features_[i].encoding]++;
+    if (features_[i].encoding == PACKED) {
+      packedShorts += features_[i].pvec->getWidth() / 16.0;
+    }
 
     LOG(INFO) << "feature: " << cfg_.getFeatureName(i)
               << " num transitions: " << features_[i].transitions.size()
+              << ", lookup size: " << features_[i].lookup.size()
               << ",encoding: " << features_[i].encoding;
   }
   preBucketing_ = false;
   CHECK(hist[3] == 0) << "no double features after bucketing";
   LOG(INFO) << "total memory saving over double: "
-            << 1 - (hist[1] * 0.5 + hist[2])/(4.0*numFeatures_);
+            << 1 - (hist[1] * 0.5 + hist[2] + packedShorts)/(4.0*numFeatures_);
   LOG(INFO) << "additional memory saving over short: "
-            << 1 - (hist[1] * 0.5 + hist[2])/numFeatures_;
+            << 1 - (hist[1] * 0.5 + hist[2] + packedShorts)/numFeatures_;
+  LOG(INFO) << hist[4] << " packed features, memory saving over short: "
+            << (hist[4] > 0 ? 1 - packedShorts / hist[4] : 0.0);
+}
+
+void DataSet::buildRowBytes() {
+  if (!FLAGS_row_major_bytes || !rowBytes_.empty()) {
+    return;
+  }
+
+  rowByteWidth_ = 0;
+  for (int i = 0; i < numFeatures_; i++) {
+    if (features_[i].encoding == BYTE) {
+      rowByteColumns_[i] = rowByteWidth_++;
+    }
+  }
+
+  rowBytes_.resize(size_t(numExamples_) * rowByteWidth_);
+  for (int i = 0; i < numFeatures_; i++) {
+    if (rowByteColumns_[i] >= 0) {
+      const auto& bvec = *(features_[i].bvec);
+      uint8_t* out = rowBytes_.data() + rowByteColumns_[i];
+      for (int eid = 0; eid < numExamples_; eid++) {
+        out[size_t(eid) * rowByteWidth_] = bvec[eid];
+      }
+    }
+  }
+  LOG(INFO) << "row-major copy of " << rowByteWidth_ << " byte features: "
+            << rowBytes_.size() << " bytes";
 }
 
 }
@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <algorithm>
 #include <boost/scoped_array.hpp>
+#include <cmath>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -34,24 +36,166 @@ enum FeatureEncoding {
   EMPTY   = 0,
   BYTE    = 1,
   SHORT   = 2,
-  DOUBLE  = 3
+  DOUBLE  = 3,
+  PACKED  = 4
 };
 
+// Buckets packed in width bits each, for columns with too many buckets for
+// a byte but few enough for 12 bits. Every block of 64 values takes width
+// whole words, so a block unpacks from aligned words in one go.
+class PackedVector {
+ public:
+  static const int kMaxWidth = 12;
+
+  explicit PackedVector(int width) : width_(width), size_(0) {
+    CHECK(width > 0 && width <= kMaxWidth);
+  }
+
+  int getWidth() const {
+    return width_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  uint16_t operator[](size_t i) const {
+    const size_t bit = i * width_;
+    const int shift = bit & 63;
+    uint64_t v = words_[bit >> 6] >> shift;
+    if (shift + width_ > 64) {
+      v |= words_[(bit >> 6) + 1] << (64 - shift);
+    }
+    return v & ((1 << width_) - 1);
+  }
+
+  void push_back(uint16_t v) {
+    if (size_ % 64 == 0) {
+      words_.resize(words_.size() + width_, 0);
+    }
+    const size_t bit = size_ * width_;
+    const int shift = bit & 63;
+    words_[bit >> 6] |= uint64_t(v) << shift;
+    if (shift + width_ > 64) {
+      words_[(bit >> 6) + 1] |= uint64_t(v) >> (64 - shift);
+    }
+    size_++;
+  }
+
+  // unpack the values [64 * block, 64 * block + 64) into out
+  void unpackBlock(size_t block, uint16_t* out) const {
+    const uint64_t* words = &words_[block * width_];
+    switch (width_) {
+      case 9: unpack<9>(words, out); break;
+      case 10: unpack<10>(words, out); break;
+      case 11: unpack<11>(words, out); break;
+      case 12: unpack<12>(words, out); break;
+      default:
+        for (int j = 0; j < 64; j++) {
+          out[j] = (*this)[block * 64 + j];
+        }
+    }
+  }
+
+  void shrink_to_fit() {
+    words_.shrink_to_fit();
+  }
+
+ private:
+  // with the width known, the shifts are constants once unrolled
+  template <int W>
+  static void unpack(const uint64_t* words, uint16_t* out) {
+    for (int j = 0; j < 64; j++) {
+      const int bit = j * W;
+      const int shift = bit & 63;
+      uint64_t v = words[bit >> 6] >> shift;
+      if (shift + W > 64) {
+        v |= words[(bit >> 6) + 1] << (64 - shift);
+      }
+      out[j] = v & ((1 << W) - 1);
+    }
+  }
+
+  const int width_;
+  size_t size_;
+  std::vector<uint64_t> words_;
+};
+
+// Call f(id, value) for each id of subset, unpacking a whole block of
+// values at a time if subset is dense enough to use several values of
+// most blocks, looking up single values otherwise
+template <class F>
+void forEachPacked(const std::vector<int>& subset,
+                   const PackedVector& vec,
+                   F f) {
+  if (subset.size() * 8 < vec.size()) {
+    for (auto id : subset) {
+      f(id, vec[id]);
+    }
+    return;
+  }
+
+  uint16_t block[64];
+  size_t cur = static_cast<size_t>(-1);
+  for (auto id : subset) {
+    if (static_cast<size_t>(id >> 6) != cur) {
+      cur = id >> 6;
+      vec.unpackBlock(cur, block);
+    }
+    f(id, block[id & 63]);
+  }
+}
+
 // different representation of a single feature vec
-// compressed to byte/short for significant memory saving
-// and much faster splits
+// compressed to byte/packed/short for significant memory saving
+// and much faster splits. Value v is in bucket i if it is in
+// (transitions[i-1], transitions[i]]; missing values (NaN) have a
+// bucket of their own, after the last one. For categorical features,
+// transitions holds the sorted ids of the most frequent categories,
+// bucket i is category transitions[i] and all other categories share
+// the bucket after them.
 struct FeatureData {
   std::vector<double> transitions;
+  bool categorical;
+  // bucket of each integer value from lookupMin, for integer features
+  // with few values, empty otherwise
+  std::vector<uint16_t> lookup;
+  int64_t lookupMin;
   FeatureEncoding encoding;
   std::unique_ptr<std::vector<uint8_t>> bvec;
   std::unique_ptr<std::vector<uint16_t>> svec;
+  std::unique_ptr<PackedVector> pvec;
   std::unique_ptr<std::vector<double>> fvec;
 
+  uint16_t getMissingBucket() const {
+    return transitions.size() + 1;
+  }
+
+  uint16_t getBucket(double val) const {
+    const double offset = val - lookupMin;
+    if (offset >= 0 && offset < lookup.size()) {
+      const size_t i = static_cast<size_t>(offset);
+      if (i == offset) {
+        return lookup[i];
+      }
+    }
+    if (std::isnan(val)) {
+      return getMissingBucket();
+    }
+    const auto it = std::lower_bound(transitions.begin(), transitions.end(), val);
+    if (categorical && (it == transitions.end() || *it != val)) {
+      return transitions.size();
+    }
+    return it - transitions.begin();
+  }
+
   void shrink_to_fit() {
     if (encoding == BYTE) {
       bvec->shrink_to_fit();
     } else if (encoding == SHORT) {
       svec->shrink_to_fit();
+    } else if (encoding == PACKED) {
+      pvec->shrink_to_fit();
     } else if (encoding == DOUBLE) {
       fvec->shrink_to_fit();
     }
@@ -68,12 +212,20 @@ class DataSet {
  public:
   DataSet(const Config& cfg, int bucketingThresh, int examplesThresh=-1);
 
-  bool addVector(const boost::scoped_array<double>& fvec, double target);
+  // query is the key of the query of the example, from getRow, rows with
+  // the same key in a row making up a query
+  bool addVector(const boost::scoped_array<double>& fvec,
+                 double target,
+                 uint64_t query = 0);
 
   bool getRow(const std::string& line,
               double* target,
               boost::scoped_array<double>& fvec,
-              double* cmpValue = NULL) const;
+              double* cmpValue = NULL,
+              uint64_t* query = NULL) const;
+
+  // the target of a row from the value of its target column
+  double getTarget(double value) const;
 
   bool getEvalColumns(const std::string& line,
 		      boost::scoped_array<std::string>& feval) const;
@@ -82,6 +234,12 @@ class DataSet {
     return numExamples_;
   }
 
+  // with a query column, query q is the examples
+  // [queries[q], queries[q + 1]); empty otherwise
+  const std::vector<int>& getQueries() const {
+    return queries_;
+  }
+
   void getFeatureVec(const int eid, boost::scoped_array<uint16_t>& fvec) const {
     for (int i = 0; i < numFeatures_; i++) {
       if (features_[i].encoding == EMPTY) {
@@ -90,6 +248,8 @@ class DataSet {
         fvec[i] = (*features_[i].bvec)[eid];
       } else if (features_[i].encoding == SHORT) {
         fvec[i] = (*features_[i].svec)[eid];
+      } else if (features_[i].encoding == PACKED) {
+        fvec[i] = (*features_[i].pvec)[eid];
       } else {
         CHECK(false) << "invalid types";
       }
@@ -106,11 +266,27 @@ class DataSet {
     }
 
     targets_.shrink_to_fit();
+    if (!queries_.empty()) {
+      queries_.push_back(numExamples_);
+      queries_.shrink_to_fit();
+    }
+    buildRowBytes();
   }
 
  private:
   void bucketize();
 
+  // getRow for LibSvmText lines, only the fields present being parsed
+  bool getSparseRow(const std::string& line,
+                    double* target,
+                    boost::scoped_array<double>& fvec,
+                    double* cmpValue,
+                    uint64_t* query) const;
+
+  // copy the features stored as bytes row by row into rowBytes_, if
+  // row_major_bytes
+  void buildRowBytes();
+
   const Config& cfg_;
   const int bucketingThresh_;
   const int examplesThresh_;
@@ -121,22 +297,72 @@ class DataSet {
   int numFeatures_;
 
   boost::scoped_array<FeatureData> features_;
+  // feature of each column, -1 for the columns not trained on
+  std::vector<int> columnFeatures_;
   std::vector<double> targets_;
 
+  // first example of each query, and the key of the last query
+  std::vector<int> queries_;
+  uint64_t lastQuery_;
+
+  // row-major copy of the byte features, rowByteWidth_ bytes per example,
+  // and the column of each feature in it (-1 if not a byte feature)
+  std::vector<uint8_t> rowBytes_;
+  std::vector<int> rowByteColumns_;
+  int rowByteWidth_;
+
   friend class TreeRegressor;
   friend class Gbm;
 };
 
 // partition subset into left and right, depending
-// on how the values of fvec compare to fv
+// on how the values of fvec compare to fv, with the missing
+// bucket going left if missingLeft
 template<class T> void split(const std::vector<int>& subset,
                              std::vector<int>* left,
                              std::vector<int>* right,
                              const std::vector<T>& fvec,
-                             uint16_t fv) {
+                             uint16_t fv,
+                             uint16_t missingBucket,
+                             bool missingLeft) {
+
+  for (auto id : subset) {
+    if (fvec[id] <= fv || (missingLeft && fvec[id] == missingBucket)) {
+      left->push_back(id);
+    } else {
+      right->push_back(id);
+    }
+  }
+}
+
+inline void split(const std::vector<int>& subset,
+                  std::vector<int>* left,
+                  std::vector<int>* right,
+                  const PackedVector& fvec,
+                  uint16_t fv,
+                  uint16_t missingBucket,
+                  bool missingLeft) {
+
+  forEachPacked(subset, fvec, [&](int id, uint16_t v) {
+      if (v <= fv || (missingLeft && v == missingBucket)) {
+        left->push_back(id);
+      } else {
+        right->push_back(id);
+      }
+    });
+}
+
+// partition subset into left and right, depending on whether
+// the buckets of fvec are in the bitset of buckets going left
+template<class T> void splitCategories(const std::vector<int>& subset,
+                                       std::vector<int>* left,
+                                       std::vector<int>* right,
+                                       const std::vector<T>& fvec,
+                                       const std::vector<uint64_t>& categories) {
 
   for (auto id : subset) {
-    if (fvec[id] <= fv) {
+    const T v = fvec[id];
+    if ((categories[v >> 6] >> (v & 63)) & 1) {
       left->push_back(id);
     } else {
       right->push_back(id);
@@ -144,4 +370,19 @@ template<class T> void split(const std::vector<int>& subset,
   }
 }
 
+inline void splitCategories(const std::vector<int>& subset,
+                            std::vector<int>* left,
+                            std::vector<int>* right,
+                            const PackedVector& fvec,
+                            const std::vector<uint64_t>& categories) {
+
+  forEachPacked(subset, fvec, [&](int id, uint16_t v) {
+      if ((categories[v >> 6] >> (v & 63)) & 1) {
+        left->push_back(id);
+      } else {
+        right->push_back(id);
+      }
+    });
+}
+
 }
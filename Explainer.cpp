@@ -0,0 +1,301 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "Explainer.h"
+
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+
+#include "Concurrency.h"
+#include "glog/logging.h"
+
+namespace boosting {
+
+using namespace std;
+
+// count-weighted mean leaf vote of the subtree at idx, and its depth
+void getTreeStats(const vector<FlatTree<double>::Node>& nodes,
+                  const int idx,
+                  double* mean,
+                  int* depth) {
+  const auto& node = nodes[idx];
+  if (node.fid < 0) {
+    *mean = node.vote;
+    *depth = 0;
+    return;
+  }
+  const int hot = idx + 1;
+  double hotMean, coldMean;
+  int hotDepth, coldDepth;
+  getTreeStats(nodes, hot, &hotMean, &hotDepth);
+  getTreeStats(nodes, node.cold, &coldMean, &coldDepth);
+
+  const double hotFraction = (node.count > 0)
+    ? double(nodes[hot].count) / node.count : 0.5;
+  *mean = hotFraction * hotMean + (1.0 - hotFraction) * coldMean;
+  *depth = 1 + max(hotDepth, coldDepth);
+}
+
+Explainer::Explainer(const vector<TreeNode<double>*>& model,
+                     int numFeatures,
+                     ContributionMethod method)
+  : maxDepth_(0), numFeatures_(numFeatures), method_(method) {
+  bool hasCounts = true;
+  for (const auto& t : model) {
+    trees_.emplace_back(t);
+    hasCounts &= (trees_.back().getNodes().size() == 1 || t->getCount() > 0);
+
+    double mean;
+    int depth;
+    getTreeStats(trees_.back().getNodes(), 0, &mean, &depth);
+    meanVotes_.push_back(mean);
+    maxDepth_ = max(maxDepth_, depth);
+  }
+  if (method_ == TREE_SHAP && !hasCounts) {
+    LOG(WARNING) << "model without node counts, SHAP values assume even splits";
+  }
+}
+
+double Explainer::saabas(const FlatTree<double>& tree,
+                         const double* fvec,
+                         double* contrib) const {
+  const auto& nodes = tree.getNodes();
+  int idx = 0;
+  contrib[numFeatures_] += nodes[0].vote;
+  while (nodes[idx].fid >= 0) {
+    const auto& node = nodes[idx];
+    const int next = (tree.goLeft(node, fvec[node.fid]) == node.hotLeft)
+      ? idx + 1 : node.cold;
+    contrib[node.fid] += nodes[next].vote - node.vote;
+    idx = next;
+  }
+  return nodes[idx].vote;
+}
+
+void Explainer::extendPath(PathElement* path,
+                           const int depth,
+                           const double zeroFraction,
+                           const double oneFraction,
+                           const int fid) {
+  path[depth].fid = fid;
+  path[depth].zeroFraction = zeroFraction;
+  path[depth].oneFraction = oneFraction;
+  path[depth].weight = (depth == 0) ? 1.0 : 0.0;
+  for (int i = depth - 1; i >= 0; i--) {
+    path[i + 1].weight += oneFraction * path[i].weight * (i + 1) / (depth + 1);
+    path[i].weight = zeroFraction * path[i].weight * (depth - i) / (depth + 1);
+  }
+}
+
+void Explainer::unwindPath(PathElement* path,
+                           const int depth,
+                           const int pathIdx) {
+  const double oneFraction = path[pathIdx].oneFraction;
+  const double zeroFraction = path[pathIdx].zeroFraction;
+  double nextOnePortion = path[depth].weight;
+
+  for (int i = depth - 1; i >= 0; i--) {
+    if (oneFraction != 0.0) {
+      const double tmp = path[i].weight;
+      path[i].weight = nextOnePortion * (depth + 1) / ((i + 1) * oneFraction);
+      nextOnePortion =
+        tmp - path[i].weight * zeroFraction * (depth - i) / (depth + 1);
+    } else {
+      path[i].weight =
+        path[i].weight * (depth + 1) / (zeroFraction * (depth - i));
+    }
+  }
+  for (int i = pathIdx; i < depth; i++) {
+    path[i].fid = path[i + 1].fid;
+    path[i].zeroFraction = path[i + 1].zeroFraction;
+    path[i].oneFraction = path[i + 1].oneFraction;
+  }
+}
+
+double Explainer::unwoundSum(const PathElement* path,
+                             const int depth,
+                             const int pathIdx) {
+  const double oneFraction = path[pathIdx].oneFraction;
+  const double zeroFraction = path[pathIdx].zeroFraction;
+  double nextOnePortion = path[depth].weight;
+  double total = 0.0;
+
+  if (oneFraction != 0.0) {
+    for (int i = depth - 1; i >= 0; i--) {
+      const double tmp = nextOnePortion / ((i + 1) * oneFraction);
+      total += tmp;
+      nextOnePortion = path[i].weight - tmp * zeroFraction * (depth - i);
+    }
+  } else {
+    for (int i = depth - 1; i >= 0; i--) {
+      total += path[i].weight / (zeroFraction * (depth - i));
+    }
+  }
+  return total * (depth + 1);
+}
+
+void Explainer::treeShap(const FlatTree<double>& tree,
+                         const int idx,
+                         const double* fvec,
+                         double* contrib,
+                         PathElement* parentPath,
+                         int depth,
+                         double parentZeroFraction,
+                         double parentOneFraction,
+                         int parentFid) const {
+  // each level works on its own copy of the path, right after its parent's
+  PathElement* path = parentPath + depth + 1;
+  copy(parentPath, parentPath + depth + 1, path);
+  extendPath(path, depth, parentZeroFraction, parentOneFraction, parentFid);
+
+  const auto& nodes = tree.getNodes();
+  const auto& node = nodes[idx];
+  if (node.fid < 0) {
+    for (int i = 1; i <= depth; i++) {
+      const double w = unwoundSum(path, depth, i);
+      contrib[path[i].fid] +=
+        w * (path[i].oneFraction - path[i].zeroFraction) * node.vote;
+    }
+    return;
+  }
+
+  // the child the row goes to, and the other one
+  const bool toHot = tree.goLeft(node, fvec[node.fid]) == node.hotLeft;
+  const int hot = idx + 1;
+  const int next = toHot ? hot : node.cold;
+  const int other = toHot ? node.cold : hot;
+  const double nextFraction = (node.count > 0)
+    ? double(nodes[next].count) / node.count : 0.5;
+  const double otherFraction = (node.count > 0)
+    ? double(nodes[other].count) / node.count : 0.5;
+
+  // undo a previous split on the same feature
+  double incomingZeroFraction = 1.0;
+  double incomingOneFraction = 1.0;
+  int pathIdx = 0;
+  while (pathIdx <= depth && path[pathIdx].fid != node.fid) {
+    pathIdx++;
+  }
+  if (pathIdx <= depth) {
+    incomingZeroFraction = path[pathIdx].zeroFraction;
+    incomingOneFraction = path[pathIdx].oneFraction;
+    unwindPath(path, depth, pathIdx);
+    depth--;
+  }
+
+  // a branch both of whose fractions are 0, like a cold branch no
+  // profiled row went to, contributes exactly 0; following it would
+  // divide 0 by 0 when unwinding the path
+  const double nextZeroFraction = nextFraction * incomingZeroFraction;
+  if (nextZeroFraction != 0.0 || incomingOneFraction != 0.0) {
+    treeShap(tree, next, fvec, contrib, path, depth + 1,
+             nextZeroFraction, incomingOneFraction, node.fid);
+  }
+  const double otherZeroFraction = otherFraction * incomingZeroFraction;
+  if (otherZeroFraction != 0.0) {
+    treeShap(tree, other, fvec, contrib, path, depth + 1,
+             otherZeroFraction, 0.0, node.fid);
+  }
+}
+
+void Explainer::explainRange(const double* rows,
+                             const int begin,
+                             const int end,
+                             double* scores,
+                             double* contribs) const {
+  const int numContribs = numFeatures_ + 1;
+  fill(scores + begin, scores + end, 0.0);
+  fill(contribs + begin * numContribs, contribs + end * numContribs, 0.0);
+
+  // one path copy per level of the recursion
+  vector<PathElement> paths(
+    (method_ == TREE_SHAP) ? (maxDepth_ + 2) * (maxDepth_ + 3) / 2 : 0);
+
+  for (int t = 0; t < trees_.size(); t++) {
+    const auto& tree = trees_[t];
+    for (int i = begin; i < end; i++) {
+      const double* fvec = rows + i * numFeatures_;
+      double* contrib = contribs + i * numContribs;
+      if (method_ == SAABAS) {
+        scores[i] += saabas(tree, fvec, contrib);
+      } else {
+        scores[i] += tree.eval(fvec);
+        contrib[numFeatures_] += meanVotes_[t];
+        treeShap(tree, 0, fvec, contrib, paths.data(),
+                 0, 1.0, 1.0, -1);
+      }
+    }
+  }
+}
+
+class ParallelExplain : public apache::thrift::concurrency::Runnable {
+ public:
+  ParallelExplain(
+    CounterMonitor& monitor,
+    const Explainer& explainer,
+    const double* rows,
+    const int numRows,
+    double* scores,
+    double* contribs,
+    const int workIdx,
+    const int totalWorkers)
+    : monitor_(monitor), explainer_(explainer), rows_(rows),
+      numRows_(numRows), scores_(scores), contribs_(contribs),
+      workIdx_(workIdx), totalWorkers_(totalWorkers) {
+  }
+
+  void run() {
+    const int blockSize = (numRows_ + totalWorkers_ - 1) / totalWorkers_;
+    const int begin = std::min(numRows_, workIdx_ * blockSize);
+    const int end = std::min(numRows_, begin + blockSize);
+
+    explainer_.explainRange(rows_, begin, end, scores_, contribs_);
+    monitor_.decrement();
+  }
+
+ private:
+  CounterMonitor& monitor_;
+  const Explainer& explainer_;
+  const double* rows_;
+  const int numRows_;
+  double* scores_;
+  double* contribs_;
+  const int workIdx_;
+  const int totalWorkers_;
+};
+
+void Explainer::explain(const double* rows,
+                        const int numRows,
+                        double* scores,
+                        double* contribs) const {
+  if (FLAGS_num_threads > 1) {
+    CounterMonitor monitor(FLAGS_num_threads);
+    for (int wid = 0; wid < FLAGS_num_threads; wid++) {
+      Concurrency::threadManager->add(
+        boost::shared_ptr<apache::thrift::concurrency::Runnable>(
+          new ParallelExplain(monitor, *this, rows, numRows,
+                              scores, contribs, wid, FLAGS_num_threads)));
+    }
+    monitor.wait();
+  } else {
+    explainRange(rows, 0, numRows, scores, contribs);
+  }
+}
+
+}
@@ -0,0 +1,113 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "Tree.h"
+
+namespace boosting {
+
+enum ContributionMethod {
+  SAABAS = 0,
+  TREE_SHAP = 1
+};
+
+// Scores rows with a model and attributes each score to the features:
+// SAABAS uses the vote stored on every node: along the evaluation path of a
+// row, the change of vote from a partition node to its child is attributed
+// to the feature split on, and the root votes make up the bias.
+// TREE_SHAP computes exact SHAP values in polynomial time (Lundberg et al.,
+// Algorithm 2), weighting the branches by the node counts saved at
+// training, and the bias is the count-weighted mean score.
+class Explainer {
+ public:
+  Explainer(const std::vector<TreeNode<double>*>& model,
+            int numFeatures,
+            ContributionMethod method);
+
+  int getNumFeatures() const {
+    return numFeatures_;
+  }
+
+  // Score the numRows rows stored row-major in rows, in parallel over rows
+  // if num_threads > 1. For row i, contribs[i * (numFeatures + 1) + fid]
+  // is the contribution of feature fid and the last entry is the bias; the
+  // contributions of a row sum up to its score.
+  void explain(const double* rows,
+               const int numRows,
+               double* scores,
+               double* contribs) const;
+
+  // Same as explain for rows [begin, end) only. Goes through the rows tree
+  // by tree, so that each tree stays in cache.
+  void explainRange(const double* rows,
+                    const int begin,
+                    const int end,
+                    double* scores,
+                    double* contribs) const;
+
+ private:
+  struct PathElement {
+    int fid;
+    double zeroFraction;  // fraction of the paths following the node count
+    double oneFraction;   // whether the path of the row goes this way
+    double weight;
+  };
+
+  // The path of unique features from the root to the current node, along
+  // with the weights of all the subsets of those features: extendPath adds
+  // a feature, unwindPath removes the one at pathIdx (to undo an earlier
+  // split on the same feature), and unwoundSum is the total weight with the
+  // feature at pathIdx removed.
+  static void extendPath(PathElement* path,
+                         const int depth,
+                         const double zeroFraction,
+                         const double oneFraction,
+                         const int fid);
+
+  static void unwindPath(PathElement* path, const int depth, const int pathIdx);
+
+  static double unwoundSum(const PathElement* path,
+                           const int depth,
+                           const int pathIdx);
+
+  double saabas(const FlatTree<double>& tree,
+                const double* fvec,
+                double* contrib) const;
+
+  void treeShap(const FlatTree<double>& tree,
+                const int idx,
+                const double* fvec,
+                double* contrib,
+                PathElement* parentPath,
+                int depth,
+                double parentZeroFraction,
+                double parentOneFraction,
+                int parentFid) const;
+
+  std::vector<FlatTree<double>> trees_;
+  std::vector<double> meanVotes_;  // count-weighted mean score of each tree
+  int maxDepth_;
+  const int numFeatures_;
+  const ContributionMethod method_;
+};
+
+}
@@ -0,0 +1,224 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Checks the approximations of FastMath.h against libm over their working
+// range, that the blocked LogisticFun loss and gradient built on them stay
+// within kLossTolerance of the libm versions on a fixed synthetic dataset,
+// and that a model trained with them ends within kModelLossTolerance of
+// the final training loss of one trained with libm. Exits with 1 if any
+// check fails.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+#include "Config.h"
+#include "DataSet.h"
+#include "FastMath.h"
+#include "Gbm.h"
+#include "LogisticFun.h"
+#include "Tree.h"
+
+using namespace boosting;
+using namespace std;
+
+// relative errors allowed for the functions, for the total loss and each
+// gradient of the dataset, and for the final loss of a trained model
+static const double kFunTolerance = 1e-14;
+static const double kLossTolerance = 1e-12;
+static const double kModelLossTolerance = 1e-9;
+
+static double libmLog1pExp(double x) {
+  return max(x, 0.0) + log1p(exp(-fabs(x)));
+}
+
+// LogisticFun with its gradient and loss computed with libm
+class LibmLogisticFun : public LogisticFun {
+ public:
+  void getGradient(const vector<double>& y,
+                   const boost::scoped_array<double>& F,
+                   boost::scoped_array<double>& grad) const {
+    for (int i = 0; i < y.size(); i++) {
+      grad[i] = 2.0 * y[i] / (1.0 + exp(2.0 * y[i] * F[i]));
+    }
+  }
+
+  double getExampleLoss(const double y, const double f) const {
+    return libmLog1pExp(-2.0 * y * f);
+  }
+
+  double getBlockLoss(const double* y, const double* f, const int size) const {
+    double loss = 0.0;
+    for (int i = 0; i < size; i++) {
+      loss += getExampleLoss(y[i], f[i]);
+    }
+    return loss;
+  }
+};
+
+// the next value of a fixed linear congruential generator
+static uint64_t nextRandom(uint64_t* state) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state;
+}
+
+// uniform in [0, 1)
+static double nextUniform(uint64_t* state) {
+  return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// the libm training loss of a model trained with fun on a fixed synthetic
+// dataset: labels +-1 of noisy linear scores of 4 uniform features
+static double getModelLoss(const Config& cfg, const GbmFun& fun) {
+  const int numExamples = 20000;
+  const int numFeatures = cfg.getNumFeatures();
+  DataSet ds(cfg, -1, -1);
+  vector<vector<double>> rows;
+  vector<double> labels;
+  boost::scoped_array<double> fvec(new double[numFeatures]);
+  uint64_t state = 54321;
+  for (int i = 0; i < numExamples; i++) {
+    for (int fid = 0; fid < numFeatures; fid++) {
+      fvec[fid] = floor(nextUniform(&state) * 1000.0);
+    }
+    const double score = (fvec[0] - fvec[1] + 0.5 * fvec[2]) / 500.0
+      + nextUniform(&state) - 0.5;
+    labels.push_back(ds.getTarget(score > 0.25 ? 1.0 : 0.0));
+    ds.addVector(fvec, labels.back());
+    rows.emplace_back(fvec.get(), fvec.get() + numFeatures);
+  }
+  ds.close();
+
+  vector<TreeNode<double>*> model;
+  vector<double> fimps(numFeatures, 0.0);
+  srand(1);
+  Gbm(fun, ds, cfg).getModel(&model, fimps.data());
+
+  LibmLogisticFun libm;
+  double loss = 0.0;
+  for (int i = 0; i < numExamples; i++) {
+    copy(rows[i].begin(), rows[i].end(), fvec.get());
+    double f = 0.0;
+    for (const auto& t : model) {
+      f += t->eval(fvec);
+    }
+    loss += libm.getExampleLoss(labels[i], f);
+  }
+  for (const auto& t : model) {
+    delete t;
+  }
+  return loss / numExamples;
+}
+
+static bool check(const char* name, double maxError, double tolerance) {
+  const bool ok = maxError <= tolerance;
+  printf("%s %s: max relative error %g (tolerance %g)\n",
+         ok ? "PASS" : "FAIL", name, maxError, tolerance);
+  return ok;
+}
+
+static double relativeError(double value, double expected) {
+  return fabs(value - expected) / fabs(expected);
+}
+
+// max relative error of f against g on n points evenly spread over [lo, hi]
+template <class F, class G>
+static double maxRelativeError(F f, G g, double lo, double hi, int n) {
+  double maxError = 0.0;
+  for (int i = 0; i <= n; i++) {
+    const double x = lo + (hi - lo) * i / n;
+    maxError = max(maxError, relativeError(f(x), g(x)));
+  }
+  return maxError;
+}
+
+int main() {
+  const int n = 1000000;
+  bool ok = true;
+
+  ok &= check("fastExp on [-708, 708]",
+              maxRelativeError(fastExp, [](double x) { return exp(x); },
+                               -708.0, 708.0, n),
+              kFunTolerance);
+  ok &= check("fastLog1p on [0, 1]",
+              maxRelativeError(fastLog1p, [](double x) { return log1p(x); },
+                               1e-300, 1.0, n),
+              kFunTolerance);
+  ok &= check("fastLog1pExp on [-700, 700]",
+              maxRelativeError(fastLog1pExp, libmLog1pExp, -700.0, 700.0, n),
+              kFunTolerance);
+
+  // labels +-1 and scores in [-10, 10] from a fixed linear congruential
+  // generator
+  const int size = 100000;
+  vector<double> y(size);
+  boost::scoped_array<double> F(new double[size]), grad(new double[size]);
+  uint64_t state = 12345;
+  for (int i = 0; i < size; i++) {
+    y[i] = (nextRandom(&state) >> 63) ? 1.0 : -1.0;
+    F[i] = nextUniform(&state) * 20.0 - 10.0;
+  }
+
+  LogisticFun fun;
+  const double loss = fun.getBlockLoss(y.data(), F.get(), size);
+  double expectedLoss = 0.0;
+  for (int i = 0; i < size; i++) {
+    expectedLoss += log1p(exp(-2.0 * y[i] * F[i]));
+  }
+  ok &= check("LogisticFun block loss", relativeError(loss, expectedLoss),
+              kLossTolerance);
+
+  fun.getGradient(y, F, grad);
+  double maxGradError = 0.0;
+  for (int i = 0; i < size; i++) {
+    const double expected = 2.0 * y[i] / (1.0 + exp(2.0 * y[i] * F[i]));
+    maxGradError = max(maxGradError, relativeError(grad[i], expected));
+  }
+  ok &= check("LogisticFun gradient", maxGradError, kLossTolerance);
+
+  // a few iterations of training with each, on a single thread
+  const char* configFile = "fastmath_test_config.json";
+  ofstream(configFile)
+    << "{\"num_trees\": 20, \"num_leaves\": 8, "
+    << "\"example_sampling_rate\": 1.0, \"feature_sampling_rate\": 1.0, "
+    << "\"learning_rate\": 0.1, \"loss_function\": \"logistic\", "
+    << "\"all_columns\": [\"f0\", \"f1\", \"f2\", \"f3\", \"label\"], "
+    << "\"train_columns\": [\"f0\", \"f1\", \"f2\", \"f3\"], "
+    << "\"target_column\": \"label\", \"weak_columns\": [], "
+    << "\"eval_output_columns\": [], \"delimiter\": \"TAB\"}\n";
+  Config cfg;
+  const bool readConfig = cfg.readConfig(configFile);
+  unlink(configFile);
+  if (!readConfig) {
+    printf("FAIL can not read %s\n", configFile);
+    return 1;
+  }
+  const double fastLoss = getModelLoss(cfg, LogisticFun());
+  const double libmLoss = getModelLoss(cfg, LibmLogisticFun());
+  printf("final training loss %.17g with FastMath, %.17g with libm\n",
+         fastLoss, libmLoss);
+  ok &= check("LogisticFun model loss", relativeError(fastLoss, libmLoss),
+              kModelLossTolerance);
+
+  return ok ? 0 : 1;
+}
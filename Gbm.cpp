@@ -19,78 +19,50 @@
 
 #include "Gbm.h"
 
+#include <algorithm>
 #include <boost/scoped_array.hpp>
-#include <boost/shared_ptr.hpp>
+#include <chrono>
+#include <limits>
 #include <vector>
 
 #include "Concurrency.h"
 #include "Config.h"
 #include "DataSet.h"
 #include "GbmFun.h"
+#include "ModelWriter.h"
 #include "Tree.h"
 #include "TreeRegressor.h"
 #include <gflags/gflags.h>
 
+DEFINE_double(training_time_budget, -1.0,
+              "wall clock seconds to build the trees in, -1 for unlimited: "
+              "training stops before a tree that would not finish in time");
+
+DEFINE_bool(time_budget_sampling, false,
+            "lower the example sampling rate of the remaining trees to fit "
+            "them all in the training time budget, before stopping early");
+
+DECLARE_int32(min_leaf_examples);
+
 namespace boosting {
 
 using namespace std;
 
+// examples scored and summed up per block when evaluating a tree
+static const int kEvalBlockSize = 1 << 14;
+
+static double getSeconds(const chrono::steady_clock::duration& d) {
+  return chrono::duration<double>(d).count();
+}
+
 Gbm::Gbm(const GbmFun& fun, const DataSet& ds, const Config& cfg)
   : fun_(fun), ds_(ds), cfg_(cfg) {
 }
 
-class ParallelEval : public apache::thrift::concurrency::Runnable {
- public:
-  ParallelEval(
-    CounterMonitor& monitor,
-    const int numExamples,
-    const int numFeatures,
-    const GbmFun& fun,
-    const std::unique_ptr<TreeNode<uint16_t>>& weakModel,
-    const DataSet& ds,
-    const vector<double>& targets,
-    boost::scoped_array<double>& F,
-    boost::scoped_array<double>& subLoss,
-    const int workIdx,
-    const int totalWorkers)
-    : monitor_(monitor), numExamples_(numExamples),
-      numFeatures_(numFeatures), fun_(fun), weakModel_(weakModel),
-      ds_(ds), targets_(targets), F_(F),
-      subLoss_(subLoss), workIdx_(workIdx),
-      totalWorkers_(totalWorkers) {
-  }
-
-  void run() {
-    //boost::scoped_array<uint16_t> fvec(new uint16_t[numFeatures_]);
-    for (int i = 0; i < numExamples_; i++) {
-      if (i % totalWorkers_ == workIdx_) {
-        //ds_.getFeatureVec(i, fvec);
-        //double score = weakModel_->eval(fvec);
-        double score = ds_.getPrediction(weakModel_.get(), i);
-        F_[i] += score;
-        subLoss_[workIdx_] += fun_.getExampleLoss(targets_[i], F_[i]);
-      }
-    }
-    monitor_.decrement();
-  }
-
- private:
-  CounterMonitor& monitor_;
-  const int numExamples_;
-  const int numFeatures_;
-  const GbmFun& fun_;
-  const std::unique_ptr<TreeNode<uint16_t>>& weakModel_;
-  const DataSet& ds_;
-  const vector<double> targets_;
-  boost::scoped_array<double>& F_;
-  boost::scoped_array<double>& subLoss_;
-  const int workIdx_;
-  const int totalWorkers_;
-};
-
 void Gbm::getModel(
   vector<TreeNode<double>*>* model,
-  double fimps[]) {
+  double fimps[],
+  ModelWriter* writer) {
 
   const int numExamples = ds_.getNumExamples();
 
@@ -103,60 +75,106 @@ void Gbm::getModel(
   }
 
   model->push_back(new LeafNode<double>(f0));
+  if (writer != NULL) {
+    writer->addTree(model->back());
+  }
 
   double initLoss = fun_.getInitLoss(ds_.targets_);
 
   LOG(INFO) << "init avg loss " << initLoss / numExamples;
 
+  // expected number of comparisons to evaluate a row with the model
+  double comparisons = 0.0;
+
+  // for the time budget: the cost of an iteration is estimated from the
+  // last one, as the fixed cost of the gradient and of scoring all the
+  // examples plus that of building the tree, proportional to the example
+  // sampling rate
+  const auto startTime = chrono::steady_clock::now();
+  double lastTreeSeconds = 0.0;
+  double lastFixedSeconds = 0.0;
+  double samplingRate = cfg_.getExampleSamplingRate();
+  const double minSamplingRate = min(samplingRate,
+    2.0 * FLAGS_min_leaf_examples * cfg_.getNumLeaves() / numExamples);
+
   for (int it = 0; it < cfg_.getNumTrees(); it++) {
 
+    const auto treeStartTime = chrono::steady_clock::now();
+    if (FLAGS_training_time_budget >= 0.0 && it > 0) {
+      const double remaining = FLAGS_training_time_budget
+        - getSeconds(treeStartTime - startTime);
+      const double secondsPerRate = lastTreeSeconds / samplingRate;
+      if (FLAGS_time_budget_sampling) {
+        const double rate = (remaining / (cfg_.getNumTrees() - it)
+                             - lastFixedSeconds) / secondsPerRate;
+        samplingRate = max(minSamplingRate,
+                           min(cfg_.getExampleSamplingRate(), rate));
+      }
+      if (remaining < lastFixedSeconds + samplingRate * secondsPerRate) {
+        LOG(INFO) << "time budget reached, stopping after " << it
+                  << " trees";
+        break;
+      }
+    }
+
     LOG(INFO) << "------- iteration " << it << " -------";
 
     fun_.getGradient(ds_.targets_, F, y);
+
+    const auto buildStartTime = chrono::steady_clock::now();
     TreeRegressor regressor(ds_, y, fun_);
 
     std::unique_ptr<TreeNode<uint16_t>> weakModel(
-      regressor.getTree(cfg_.getNumLeaves(), cfg_.getExampleSamplingRate(),
+      regressor.getTree(cfg_.getNumLeaves(), samplingRate,
                         cfg_.getFeatureSamplingRate(), fimps));
+    lastTreeSeconds = getSeconds(chrono::steady_clock::now() - buildStartTime);
 
     weakModel->scale(cfg_.getLearningRate());
 
+    const double treeComparisons = getExpectedComparisons(weakModel.get());
+    comparisons += treeComparisons;
+    LOG(INFO) << "expected comparisons per row: " << treeComparisons
+              << ", model total: " << comparisons;
+
     model->push_back(mapTree(weakModel.get()));
+    if (writer != NULL) {
+      writer->addTree(model->back());
+    }
 
     VLOG(1) << toPrettyJson(weakModel->toJson(cfg_));
-    double newLoss = 0.0;
-
-    if (FLAGS_num_threads > 1) {
-      CounterMonitor monitor(FLAGS_num_threads);
-      boost::scoped_array<double> subLoss(new double[FLAGS_num_threads]);
-      for (int wid = 0; wid < FLAGS_num_threads; wid++) {
-        subLoss[wid] = 0.0;
-        Concurrency::threadManager->add(
-          boost::shared_ptr<apache::thrift::concurrency::Runnable>(
-            new ParallelEval(monitor, numExamples, ds_.numFeatures_,
-                             fun_, weakModel,
-                             ds_, ds_.targets_, F, subLoss,
-                             wid, FLAGS_num_threads)));
-      }
-      monitor.wait();
-
-      for (int wid = 0; wid < FLAGS_num_threads; wid++) {
-        newLoss += subLoss[wid];
-      }
-    } else {
-      //boost::scoped_array<uint16_t> fvec(new uint16_t[ds_.numFeatures_]);
-      for (int i = 0; i < numExamples; i++) {
-        // ds_.getFeatureVec(i, fvec);
-        // double score = weakModel->eval(fvec);
-        double score = ds_.getPrediction(weakModel.get(), i);
-        F[i] += score;
-        newLoss += fun_.getExampleLoss(ds_.targets_[i], F[i]);
+    // score the examples and sum up their losses block by block, the same
+    // way whatever the number of threads; with queries, a block is a query
+    auto evalBlock = [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        F[i] += ds_.getPrediction(weakModel.get(), i);
       }
-    }
+      return fun_.getBlockLoss(ds_.targets_.data() + begin,
+                               F.get() + begin, end - begin);
+    };
+    const double newLoss = ds_.getQueries().empty()
+      ? parallelBlockSum(numExamples, kEvalBlockSize, evalBlock)
+      : parallelBlockSum(ds_.getQueries(), evalBlock);
 
     LOG(INFO) << "total avg loss " << newLoss/numExamples
               << " reduction: " << 1.0 - newLoss/initLoss;
+
+    lastFixedSeconds = getSeconds(chrono::steady_clock::now() - treeStartTime)
+      - lastTreeSeconds;
+    LOG(INFO) << "tree time " << lastTreeSeconds << " sec, gradient and "
+              << "eval time " << lastFixedSeconds << " sec, example sampling "
+              << "rate " << samplingRate;
+  }
+
+  int numUsed = 0;
+  double featureCost = 0.0;
+  for (int fid = 0; fid < cfg_.getNumFeatures(); fid++) {
+    if (fimps[fid] > 0.0) {
+      numUsed++;
+      featureCost += cfg_.getFeatureCost(fid);
+    }
   }
+  LOG(INFO) << "features used: " << numUsed
+            << ", total feature cost: " << featureCost;
 }
 
 TreeNode<double>* Gbm::mapTree(const TreeNode<uint16_t>* rt) {
@@ -164,16 +182,39 @@ TreeNode<double>* Gbm::mapTree(const TreeNode<uint16_t>* rt) {
     dynamic_cast<const PartitionNode<uint16_t>*>(rt);
   if (pnode != NULL) {
     int fid = pnode->getFid();
-    PartitionNode<double>* newNode = new PartitionNode<double>(
-      fid, ds_.features_[fid].transitions[pnode->getFv()]);
+    const auto& transitions = ds_.features_[fid].transitions;
+    PartitionNode<double>* newNode;
+    if (pnode->isCategorical()) {
+      // set of buckets to set of category ids; the buckets of other
+      // categories and missing values are not ids, the former always goes
+      // right and the latter follows isMissingLeft
+      newNode = new PartitionNode<double>(fid, 0.0);
+      CategorySet categories;
+      for (const int64_t bucket : pnode->getCategories().getList()) {
+        if (bucket < transitions.size()) {
+          categories.add(transitions[bucket]);
+        }
+      }
+      newNode->setCategories(categories);
+    } else {
+      // a split past the last transition only separates the missing values:
+      // all other values, infinity included, share its buckets and go left
+      const double fv = (pnode->getFv() < transitions.size())
+        ? transitions[pnode->getFv()] : numeric_limits<double>::infinity();
+      newNode = new PartitionNode<double>(fid, fv);
+    }
     newNode->setVote(pnode->getVote());
+    newNode->setMissingLeft(pnode->isMissingLeft());
+    newNode->setCount(pnode->getCount());
     newNode->setLeft(mapTree(pnode->getLeft()));
     newNode->setRight(mapTree(pnode->getRight()));
     return newNode;
   } else {
     const LeafNode<uint16_t>* lfnode =
       dynamic_cast<const LeafNode<uint16_t>*>(rt);
-    return new LeafNode<double>(lfnode->getVote());
+    LeafNode<double>* newNode = new LeafNode<double>(lfnode->getVote());
+    newNode->setCount(lfnode->getCount());
+    return newNode;
   }
 }
 
@@ -27,6 +27,7 @@ namespace boosting {
 class Config;
 class DataSet;
 class GbmFun;
+class ModelWriter;
 
 template<class T> class TreeNode;
 
@@ -36,8 +37,10 @@ class Gbm {
       const DataSet& ds,
       const Config& cfg);
 
+  // if writer is set, each tree is written out as soon as it is built
   void getModel(std::vector<TreeNode<double>*>* model,
-                double fimps[]);
+                double fimps[],
+                ModelWriter* writer = NULL);
 
  private:
 
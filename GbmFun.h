@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <boost/scoped_array.hpp>
 #include <vector>
 
@@ -30,6 +31,11 @@ namespace boosting {
 // rank), etc.
 class GbmFun {
  public:
+  // vote of a leaf holding the examples of subset, y being the gradient.
+  // Called concurrently for different leaves, so it must not write any
+  // shared state; it may read state cached by the last getGradient (the
+  // residuals or hessians of the current iteration), which getGradient
+  // alone writes.
   virtual double getLeafVal(const std::vector<int>& subset,
                             const boost::scoped_array<double>& y) const = 0;
 
@@ -50,10 +56,69 @@ class GbmFun {
   virtual int getNumExamples() const = 0;
 
   virtual double getLoss() const = 0;
+
+  // block versions of getExampleLoss/accumulateExampleLoss over the
+  // contiguous spans y[0, size) and f[0, size), so that hot loops pay
+  // one virtual call per block instead of one per example.
+  virtual double getBlockLoss(const double* y,
+                              const double* f,
+                              const int size) const = 0;
+
+  virtual void accumulateBlockLoss(const double* y,
+                                   const double* f,
+                                   const int size) = 0;
+
+  virtual ~GbmFun() {}
 };
 
+// Implements the gradient and block loss of GbmFun on top of Fun's
+// getExampleGradient and getExampleLoss, which are called non-virtually
+// so that the per-example work is inlined into tight loops.
+template <class Fun>
+class BlockGbmFun : public GbmFun {
+ public:
+  void getGradient(const std::vector<double>& y,
+                   const boost::scoped_array<double>& F,
+                   boost::scoped_array<double>& grad) const {
+    const Fun& fun = static_cast<const Fun&>(*this);
+    const int size = y.size();
+    const double* f = F.get();
+    double* g = grad.get();
+
+    for (int i = 0; i < size; i++) {
+      g[i] = fun.Fun::getExampleGradient(y[i], f[i]);
+    }
+  }
+
+  double getBlockLoss(const double* y,
+                      const double* f,
+                      const int size) const {
+    const Fun& fun = static_cast<const Fun&>(*this);
+    // a local copy, as std::min binding a reference to the static member
+    // would need it defined out of class
+    const int chunkSize = kLossChunkSize;
+    double buf[kLossChunkSize];
+    double loss = 0.0;
+
+    // per-example losses are computed chunk by chunk into buf, which
+    // vectorizes, and then summed in order
+    for (int begin = 0; begin < size; begin += chunkSize) {
+      const int n = std::min(chunkSize, size - begin);
+      for (int i = 0; i < n; i++) {
+        buf[i] = fun.Fun::getExampleLoss(y[begin + i], f[begin + i]);
+      }
+      for (int i = 0; i < n; i++) {
+        loss += buf[i];
+      }
+    }
+    return loss;
+  }
 
-class LeastSquareFun : public GbmFun {
+ private:
+  static const int kLossChunkSize = 256;
+};
+
+class LeastSquareFun : public BlockGbmFun<LeastSquareFun> {
  public:
   LeastSquareFun() : numExamples_(0), sumy_(0.0), sumy2_(0.0), l2_(0.0) {
   }
@@ -76,15 +141,8 @@ class LeastSquareFun : public GbmFun {
     return sum/yvec.size();
   }
 
-  void getGradient(const std::vector<double>& y,
-                   const boost::scoped_array<double>& F,
-                   boost::scoped_array<double>& grad) const {
-
-    int size = y.size();
-
-    for (int i = 0; i < size; i++) {
-      grad[i] = y[i] - F[i];
-    }
+  double getExampleGradient(const double y, const double f) const {
+    return y - f;
   }
 
   double getInitLoss(const std::vector<double>& yvec) const {
@@ -110,6 +168,20 @@ class LeastSquareFun : public GbmFun {
     l2_ += getExampleLoss(y, f);
   }
 
+  void accumulateBlockLoss(const double* y, const double* f, const int size) {
+    double sumy = 0.0;
+    double sumy2 = 0.0;
+
+    for (int i = 0; i < size; i++) {
+      sumy += y[i];
+      sumy2 += y[i] * y[i];
+    }
+    sumy_ += sumy;
+    sumy2_ += sumy2;
+    numExamples_ += size;
+    l2_ += getBlockLoss(y, f, size);
+  }
+
   double getReduction() const {
     return 1.0 - l2_/(sumy2_ - sumy_ * sumy_/numExamples_);
   }
@@ -0,0 +1,168 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "LambdaFun.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "Concurrency.h"
+#include "FastMath.h"
+
+namespace boosting {
+
+using namespace std;
+
+static double getGain(const double label) {
+  return exp2(label) - 1.0;
+}
+
+static double getDiscount(const int rank) {
+  return 1.0 / log2(rank + 2.0);
+}
+
+// examples [0, size) by decreasing score, ties in example order
+static void sortByScore(const double* f, const int size, vector<int>* order) {
+  order->resize(size);
+  iota(order->begin(), order->end(), 0);
+  stable_sort(order->begin(), order->end(),
+              [f](int i, int j) { return f[i] > f[j]; });
+}
+
+// DCG of the examples by decreasing label
+static double getMaxDcg(const double* y, const int size) {
+  vector<double> labels(y, y + size);
+  sort(labels.begin(), labels.end(), greater<double>());
+  double dcg = 0.0;
+  for (int r = 0; r < size; r++) {
+    dcg += getGain(labels[r]) * getDiscount(r);
+  }
+  return dcg;
+}
+
+double LambdaFun::getLeafVal(const vector<int>& subset,
+                             const boost::scoped_array<double>& y) const {
+  double sumLambdas = 0.0, sumHessians = 0.0;
+  for (const auto& id : subset) {
+    sumLambdas += y[id];
+    sumHessians += hessians_[id];
+  }
+  return sumHessians > 0.0 ? sumLambdas / sumHessians : 0.0;
+}
+
+void LambdaFun::getQueryGradient(const double* y,
+                                 const double* f,
+                                 const int size,
+                                 const double maxDcg,
+                                 double* grad,
+                                 double* hessians) const {
+  if (size < 2 || maxDcg <= 0.0) {
+    fill(grad, grad + size, 0.0);
+    fill(hessians, hessians + size, 0.0);
+    return;
+  }
+
+  // scores, gains and discounts by rank, from a single sort, so that the
+  // pairs of each example with those ranked below it are a branch-free
+  // loop over contiguous arrays. The gains increase with the labels, so
+  // the sign of the gain difference says which of a pair is the more
+  // relevant, and pairs with equal labels get no lambda
+  vector<int> order;
+  sortByScore(f, size, &order);
+  vector<double> scores(size), gains(size), discounts(size);
+  vector<double> lambdas(size, 0.0), rankHessians(size, 0.0);
+  for (int r = 0; r < size; r++) {
+    scores[r] = f[order[r]];
+    gains[r] = getGain(y[order[r]]);
+    discounts[r] = getDiscount(r);
+  }
+
+  const double scale = 1.0 / maxDcg;
+  for (int r1 = 0; r1 < size; r1++) {
+    double lambda1 = 0.0, hessian1 = 0.0;
+    for (int r2 = r1 + 1; r2 < size; r2++) {
+      const double gainDiff = gains[r1] - gains[r2];
+      // score of the less relevant minus that of the more relevant
+      const double scoreDiff = (gainDiff > 0.0)
+        ? scores[r2] - scores[r1] : scores[r1] - scores[r2];
+      const double rho = 1.0 / (1.0 + fastExp(-scoreDiff));
+      // |delta NDCG| * rho, signed towards the more relevant
+      const double lambda =
+        gainDiff * (discounts[r1] - discounts[r2]) * scale * rho;
+      const double hessian = fabs(lambda) * (1.0 - rho);
+      lambda1 += lambda;
+      lambdas[r2] -= lambda;
+      hessian1 += hessian;
+      rankHessians[r2] += hessian;
+    }
+    lambdas[r1] += lambda1;
+    rankHessians[r1] += hessian1;
+  }
+
+  for (int r = 0; r < size; r++) {
+    grad[order[r]] = lambdas[r];
+    hessians[order[r]] = rankHessians[r];
+  }
+}
+
+void LambdaFun::getGradient(const vector<double>& y,
+                            const boost::scoped_array<double>& F,
+                            boost::scoped_array<double>& grad) const {
+  const int numQueries = max<int>(0, queries_.size() - 1);
+  const bool newQueries = (maxDcgs_.size() != numQueries);
+  if (newQueries) {
+    maxDcgs_.resize(numQueries);
+  }
+  hessians_.resize(y.size());
+
+  parallelForBlocks(queries_, [&](int q, int begin, int end) {
+      if (newQueries) {
+        maxDcgs_[q] = getMaxDcg(&y[begin], end - begin);
+      }
+      getQueryGradient(&y[begin], &F[begin], end - begin, maxDcgs_[q],
+                       &grad[begin], &hessians_[begin]);
+    });
+}
+
+double LambdaFun::getInitLoss(const vector<double>& y) const {
+  const vector<double> f(y.size(), getF0(y));
+  return parallelBlockSum(queries_, [&](int begin, int end) {
+      return getBlockLoss(&y[begin], &f[begin], end - begin);
+    });
+}
+
+double LambdaFun::getBlockLoss(const double* y,
+                               const double* f,
+                               const int size) const {
+  const double maxDcg = getMaxDcg(y, size);
+  if (maxDcg <= 0.0) {
+    return 0.0;
+  }
+
+  vector<int> order;
+  sortByScore(f, size, &order);
+  double dcg = 0.0;
+  for (int r = 0; r < size; r++) {
+    dcg += getGain(y[order[r]]) * getDiscount(r);
+  }
+  return 1.0 - dcg / maxDcg;
+}
+
+}
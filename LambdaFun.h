@@ -0,0 +1,116 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "GbmFun.h"
+
+namespace boosting {
+
+// LambdaMART (Burges, 2010): ranking by NDCG, the examples grouped in
+// queries. Each pair of examples of a query with different labels pulls
+// their scores apart with a lambda, the RankNet gradient of the pair scaled
+// by the change of NDCG from swapping them; a leaf takes a Newton step, the
+// sum of its lambdas over the sum of their second derivatives, saved by
+// getGradient. The gains of the labels are 2^label - 1.
+//
+// The loss of a query is 1 - its NDCG: getBlockLoss/accumulateBlockLoss
+// take the examples of one whole query, and getReduction is the mean NDCG
+// of the queries accumulated.
+class LambdaFun : public GbmFun {
+ public:
+  // queries: those of the training data (see DataSet::getQueries), read
+  // by getGradient and getInitLoss
+  explicit LambdaFun(const std::vector<int>& queries)
+    : queries_(queries), numExamples_(0), numQueries_(0), loss_(0.0) {
+  }
+
+  double getLeafVal(const std::vector<int>& subset,
+                    const boost::scoped_array<double>& y) const;
+
+  // the scores only matter within queries
+  double getF0(const std::vector<double>& y) const {
+    return 0.0;
+  }
+
+  // the queries are done in parallel, each sorting its examples by score
+  // once and then going over its pairs in rank order
+  void getGradient(const std::vector<double>& y,
+                   const boost::scoped_array<double>& F,
+                   boost::scoped_array<double>& grad) const;
+
+  double getInitLoss(const std::vector<double>& y) const;
+
+  // a single example is a query of its own, perfectly ranked
+  double getExampleLoss(const double y, const double f) const {
+    return 0.0;
+  }
+
+  void accumulateExampleLoss(const double y, const double f) {
+    accumulateBlockLoss(&y, &f, 1);
+  }
+
+  double getReduction() const {
+    return numQueries_ > 0 ? 1.0 - loss_ / numQueries_ : 0.0;
+  }
+
+  int getNumExamples() const {
+    return numExamples_;
+  }
+
+  double getLoss() const {
+    return loss_;
+  }
+
+  double getBlockLoss(const double* y,
+                      const double* f,
+                      const int size) const;
+
+  void accumulateBlockLoss(const double* y,
+                           const double* f,
+                           const int size) {
+    loss_ += getBlockLoss(y, f, size);
+    numExamples_ += size;
+    numQueries_++;
+  }
+
+ private:
+  // lambdas and second derivatives of the examples of a query
+  void getQueryGradient(const double* y,
+                        const double* f,
+                        const int size,
+                        const double maxDcg,
+                        double* grad,
+                        double* hessians) const;
+
+  const std::vector<int>& queries_;
+
+  // of the last getGradient, for getLeafVal
+  mutable std::vector<double> hessians_;
+  // DCG of the ideal ranking of each training query, computed once
+  mutable std::vector<double> maxDcgs_;
+
+  int numExamples_;
+  int numQueries_;
+  double loss_;
+};
+
+}
@@ -19,12 +19,16 @@
 
 #pragma once
 
+#include "FastMath.h"
 #include "GbmFun.h"
 
 namespace boosting {
 
-class LogisticFun : public GbmFun {
+class LogisticFun : public BlockGbmFun<LogisticFun> {
  public:
+  LogisticFun() : numExamples_(0), posCount_(0), logloss_(0.0) {
+  }
+
   double getLeafVal(const std::vector<int>& subset,
 		    const boost::scoped_array<double>& y) const {
     double wx = 0.0, wy = 0.0;
@@ -45,13 +49,8 @@ class LogisticFun : public GbmFun {
     return 0.5 * log((1.0 + ybar)/(1.0 - ybar));
   }
 
-  void getGradient(const std::vector<double>& y,
-		   const boost::scoped_array<double>& F,
-		   boost::scoped_array<double>& grad) const {
-    int size = y.size();
-    for (int i = 0; i < size; i++) {
-      grad[i] = 2.0 * y[i]/(1.0 + exp(2.0 * y[i] * F[i]));
-    }
+  double getExampleGradient(const double y, const double f) const {
+    return 2.0 * y/(1.0 + fastExp(2.0 * y * f));
   }
 
   double getInitLoss(const std::vector<double>& y) const {
@@ -65,7 +64,7 @@ class LogisticFun : public GbmFun {
   }
 
   double getExampleLoss(const double y, const double f) const {
-    return log(1.0 + exp(-2.0 * y * f));
+    return fastLog1pExp(-2.0 * y * f);
   }
 
   void accumulateExampleLoss(const double y, const double f) {
@@ -76,6 +75,16 @@ class LogisticFun : public GbmFun {
     logloss_ += getExampleLoss(y, f);
   }
 
+  void accumulateBlockLoss(const double* y, const double* f, const int size) {
+    int posCount = 0;
+    for (int i = 0; i < size; i++) {
+      posCount += (y[i] > 0);
+    }
+    numExamples_ += size;
+    posCount_ += posCount;
+    logloss_ += getBlockLoss(y, f, size);
+  }
+
   double getReduction() const {
     double entropy = getEntropy(posCount_, numExamples_);
     return 1.0 - logloss_/(entropy * numExamples_);
@@ -0,0 +1,189 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "Concurrency.h"
+#include "glog/logging.h"
+
+namespace boosting {
+
+using namespace std;
+
+// buckets of the score histograms: sign, exponent and the leading mantissa
+// bits of the float score
+static const int kBucketBits = 20;
+static const int kNumBuckets = 1 << kBucketBits;
+
+// rows counted per batch, and at most as many per-thread histograms
+static const int kBatchSize = 1 << 20;
+static const int kMaxThreadHistograms = 8;
+
+RankingMetrics::RankingMetrics(bool exact, const vector<int>& ks)
+  : exact_(exact), ks_(ks), numPositives_(0), numNegatives_(0),
+    threadRows_(0), auc_(0.0) {
+  if (!exact_) {
+    const int numHistograms =
+      max(1, min(int(FLAGS_num_threads), kMaxThreadHistograms));
+    threadPositives_.assign(numHistograms, vector<uint32_t>(kNumBuckets, 0));
+    threadNegatives_.assign(numHistograms, vector<uint32_t>(kNumBuckets, 0));
+    positives_.assign(kNumBuckets, 0);
+    negatives_.assign(kNumBuckets, 0);
+  }
+}
+
+uint32_t RankingMetrics::getBucket(double score) {
+  // flip the negative floats, and the sign bit of the others, so that the
+  // bits compare as the floats do
+  const float f = static_cast<float>(score);
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+  return bits >> (32 - kBucketBits);
+}
+
+void RankingMetrics::add(const double* targets,
+                         const double* scores,
+                         const int size) {
+  for (int i = 0; i < size; i++) {
+    const bool positive = targets[i] > 0;
+    rows_.push_back(ScoredRow{scores[i], positive});
+    numPositives_ += positive;
+    numNegatives_ += !positive;
+  }
+  if (!exact_ && rows_.size() >= kBatchSize) {
+    countRows();
+  }
+}
+
+void RankingMetrics::countRows() {
+  if (rows_.empty()) {
+    return;
+  }
+
+  // the counts of each thread must not overflow
+  if (threadRows_ + rows_.size() > numeric_limits<uint32_t>::max()) {
+    mergeHistograms();
+  }
+  threadRows_ += rows_.size();
+
+  const int numHistograms = threadPositives_.size();
+  const int blockSize = (rows_.size() + numHistograms - 1) / numHistograms;
+  parallelForBlocks(rows_.size(), blockSize, [&](int b, int begin, int end) {
+      uint32_t* positives = threadPositives_[b].data();
+      uint32_t* negatives = threadNegatives_[b].data();
+      for (int i = begin; i < end; i++) {
+        const uint32_t bucket = getBucket(rows_[i].score);
+        positives[bucket] += rows_[i].positive;
+        negatives[bucket] += !rows_[i].positive;
+      }
+    });
+  rows_.clear();
+}
+
+void RankingMetrics::mergeHistograms() {
+  parallelForBlocks(kNumBuckets, kNumBuckets / 64,
+                    [&](int b, int begin, int end) {
+      for (int t = 0; t < threadPositives_.size(); t++) {
+        for (int i = begin; i < end; i++) {
+          positives_[i] += threadPositives_[t][i];
+          negatives_[i] += threadNegatives_[t][i];
+          threadPositives_[t][i] = 0;
+          threadNegatives_[t][i] = 0;
+        }
+      }
+    });
+  threadRows_ = 0;
+}
+
+void RankingMetrics::finish() {
+  if (exact_) {
+    // sort blocks in parallel, then merge pairs of them in parallel
+    const int size = rows_.size();
+    const int numThreads = max(1, int(FLAGS_num_threads));
+    int blockSize = max(1, (size + numThreads - 1) / numThreads);
+    parallelForBlocks(size, blockSize, [&](int b, int begin, int end) {
+        sort(rows_.begin() + begin, rows_.begin() + end);
+      });
+    vector<ScoredRow> merged(size);
+    for (; blockSize < size; blockSize *= 2) {
+      parallelForBlocks(size, 2 * blockSize, [&](int b, int begin, int end) {
+          const int mid = min(end, begin + blockSize);
+          merge(rows_.begin() + begin, rows_.begin() + mid,
+                rows_.begin() + mid, rows_.begin() + end,
+                merged.begin() + begin);
+        });
+      rows_.swap(merged);
+    }
+
+    // rows with the same score form a single group
+    vector<uint64_t> positives, negatives;
+    for (int i = 0; i < size; i++) {
+      if (i == 0 || rows_[i].score != rows_[i - 1].score) {
+        positives.push_back(0);
+        negatives.push_back(0);
+      }
+      positives.back() += rows_[i].positive;
+      negatives.back() += !rows_[i].positive;
+    }
+    computeMetrics(positives, negatives);
+  } else {
+    countRows();
+    mergeHistograms();
+    computeMetrics(positives_, negatives_);
+  }
+}
+
+void RankingMetrics::computeMetrics(const vector<uint64_t>& positives,
+                                    const vector<uint64_t>& negatives) {
+  // each positive row is ranked above the negative rows of lower scores
+  double correctPairs = 0.0;
+  uint64_t negativesBelow = 0;
+  for (int i = 0; i < positives.size(); i++) {
+    correctPairs += positives[i] * (negativesBelow + 0.5 * negatives[i]);
+    negativesBelow += negatives[i];
+  }
+  auc_ = (numPositives_ > 0 && numNegatives_ > 0)
+    ? correctPairs / numPositives_ / numNegatives_ : 0.0;
+
+  // positive rows among the top k, from the highest scores down
+  precisions_.clear();
+  recalls_.clear();
+  for (const int k : ks_) {
+    const int64_t top = min<int64_t>(k, getNumExamples());
+    int64_t count = 0;
+    double positivesTop = 0.0;
+    for (int i = int(positives.size()) - 1; i >= 0 && count < top; i--) {
+      const uint64_t groupSize = positives[i] + negatives[i];
+      const uint64_t taken = min<uint64_t>(groupSize, top - count);
+      if (taken > 0) {
+        positivesTop += double(positives[i]) * taken / groupSize;
+      }
+      count += taken;
+    }
+    precisions_.push_back(top > 0 ? positivesTop / top : 0.0);
+    recalls_.push_back(numPositives_ > 0 ? positivesTop / numPositives_ : 0.0);
+  }
+}
+
+}
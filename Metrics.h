@@ -0,0 +1,110 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace boosting {
+
+// Area under the ROC curve, and precision and recall of the rows with the
+// top k scores, of scores against binary targets (positive if > 0),
+// computed from the rows added block by block.
+// By default the scores are counted in a histogram of 2^20 buckets, which
+// keeps the 11 leading bits of the float mantissa: rows in the same bucket
+// count as tied. The rows are batched, and each batch is counted in
+// parallel into per-thread histograms merged at the end. With exact, all
+// the scores are kept and sorted in parallel instead.
+class RankingMetrics {
+ public:
+  RankingMetrics(bool exact, const std::vector<int>& ks);
+
+  void add(const double* targets, const double* scores, const int size);
+
+  // compute the metrics of all the rows added
+  void finish();
+
+  int64_t getNumExamples() const {
+    return numPositives_ + numNegatives_;
+  }
+
+  // ties count as half a correctly ordered pair
+  double getAuc() const {
+    return auc_;
+  }
+
+  // for the i-th k, a tie at the k-th score counts its rows in proportion
+  double getPrecision(int i) const {
+    return precisions_[i];
+  }
+
+  double getRecall(int i) const {
+    return recalls_[i];
+  }
+
+  const std::vector<int>& getKs() const {
+    return ks_;
+  }
+
+ private:
+  struct ScoredRow {
+    double score;
+    bool positive;
+
+    bool operator<(const ScoredRow& other) const {
+      return score < other.score
+        || (score == other.score && positive < other.positive);
+    }
+  };
+
+  // count rows_ into the per-thread histograms, and empty it
+  void countRows();
+
+  // add the per-thread histograms up into the histogram
+  void mergeHistograms();
+
+  // compute the metrics from the number of positive and negative rows with
+  // each score (or score bucket), by increasing score
+  void computeMetrics(const std::vector<uint64_t>& positives,
+                      const std::vector<uint64_t>& negatives);
+
+  static uint32_t getBucket(double score);
+
+  const bool exact_;
+  const std::vector<int> ks_;
+
+  std::vector<ScoredRow> rows_;  // rows not counted yet, all if exact_
+  int64_t numPositives_;
+  int64_t numNegatives_;
+
+  // per-thread histograms, and rows counted in them since the last merge
+  std::vector<std::vector<uint32_t>> threadPositives_;
+  std::vector<std::vector<uint32_t>> threadNegatives_;
+  int64_t threadRows_;
+
+  std::vector<uint64_t> positives_;
+  std::vector<uint64_t> negatives_;
+
+  double auc_;
+  std::vector<double> precisions_;
+  std::vector<double> recalls_;
+};
+
+}
@@ -0,0 +1,129 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "ModelSimplifier.h"
+
+#include <cmath>
+
+#include "Tree.h"
+#include "glog/logging.h"
+
+namespace boosting {
+
+using namespace std;
+
+// largest absolute leaf vote of the tree
+double getMaxVote(const TreeNode<double>* rt) {
+  const PartitionNode<double>* pnode =
+    dynamic_cast<const PartitionNode<double>*>(rt);
+  if (pnode == NULL) {
+    return fabs(dynamic_cast<const LeafNode<double>*>(rt)->getVote());
+  }
+  return max(getMaxVote(pnode->getLeft()), getMaxVote(pnode->getRight()));
+}
+
+// sum of count-weighted leaf votes and of counts, for the mean vote
+void getVoteSum(const TreeNode<double>* rt, double* sum, double* cnt) {
+  const PartitionNode<double>* pnode =
+    dynamic_cast<const PartitionNode<double>*>(rt);
+  if (pnode == NULL) {
+    // without counts every leaf weighs the same
+    const double weight = max<double>(rt->getCount(), 1.0);
+    *sum += weight * dynamic_cast<const LeafNode<double>*>(rt)->getVote();
+    *cnt += weight;
+  } else {
+    getVoteSum(pnode->getLeft(), sum, cnt);
+    getVoteSum(pnode->getRight(), sum, cnt);
+  }
+}
+
+ModelSimplifier::ModelSimplifier(double voteTolerance, double minTreeVote)
+  : voteTolerance_(voteTolerance), minTreeVote_(minTreeVote) {
+}
+
+TreeNode<double>* ModelSimplifier::collapse(TreeNode<double>* rt) const {
+  PartitionNode<double>* pnode = dynamic_cast<PartitionNode<double>*>(rt);
+  if (pnode == NULL) {
+    return rt;
+  }
+  pnode->setLeft(collapse(pnode->getLeft()));
+  pnode->setRight(collapse(pnode->getRight()));
+
+  const LeafNode<double>* left =
+    dynamic_cast<const LeafNode<double>*>(pnode->getLeft());
+  const LeafNode<double>* right =
+    dynamic_cast<const LeafNode<double>*>(pnode->getRight());
+  if (left == NULL || right == NULL
+      || fabs(left->getVote() - right->getVote()) > voteTolerance_) {
+    return pnode;
+  }
+
+  double sum = 0.0, cnt = 0.0;
+  getVoteSum(pnode, &sum, &cnt);
+  LeafNode<double>* leaf = new LeafNode<double>(sum / cnt);
+  leaf->setCount(pnode->getCount());
+  delete pnode;
+  return leaf;
+}
+
+void ModelSimplifier::simplify(vector<TreeNode<double>*>* model) const {
+  CHECK(!model->empty());
+
+  double bias = 0.0;
+  int64_t biasCount = 0;
+  int first = 0;
+  const LeafNode<double>* biasNode =
+    dynamic_cast<const LeafNode<double>*>((*model)[0]);
+  if (biasNode != NULL) {
+    bias = biasNode->getVote();
+    biasCount = biasNode->getCount();
+    first = 1;
+  }
+
+  vector<TreeNode<double>*> trees;
+  int numFolded = 0;
+  for (int i = first; i < model->size(); i++) {
+    TreeNode<double>* rt = collapse((*model)[i]);
+    if (dynamic_cast<const LeafNode<double>*>(rt) != NULL
+        || getMaxVote(rt) <= minTreeVote_) {
+      double sum = 0.0, cnt = 0.0;
+      getVoteSum(rt, &sum, &cnt);
+      bias += sum / cnt;
+      numFolded++;
+      delete rt;
+    } else {
+      trees.push_back(rt);
+    }
+  }
+
+  if (biasNode != NULL) {
+    delete (*model)[0];
+  }
+  LeafNode<double>* newBias = new LeafNode<double>(bias);
+  newBias->setCount(biasCount);
+
+  model->clear();
+  model->push_back(newBias);
+  model->insert(model->end(), trees.begin(), trees.end());
+
+  LOG(INFO) << "simplification folded " << numFolded
+            << " trees into the bias, " << trees.size() << " trees left";
+}
+
+}
@@ -0,0 +1,49 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace boosting {
+
+template<class T> class TreeNode;
+
+// Post-training simplification of a model, removing nodes that cost a
+// comparison at serving time but barely change the score
+class ModelSimplifier {
+ public:
+  ModelSimplifier(double voteTolerance, double minTreeVote);
+
+  // Simplify the model in place: collapse partition nodes whose two leaf
+  // votes differ by at most voteTolerance (bottom up, so whole subtrees
+  // may collapse), then fold the trees that are constant or whose leaf
+  // votes are all within minTreeVote of 0 into the bias, i.e. the leading
+  // LeafNode of the model, using their count-weighted mean vote.
+  void simplify(std::vector<TreeNode<double>*>* model) const;
+
+ private:
+  // Return the simplified tree, deleting the nodes collapsed
+  TreeNode<double>* collapse(TreeNode<double>* rt) const;
+
+  const double voteTolerance_;
+  const double minTreeVote_;
+};
+
+}
@@ -0,0 +1,182 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "ModelWriter.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <unistd.h>
+
+#include "Config.h"
+#include "Tree.h"
+#include "glog/logging.h"
+
+namespace boosting {
+
+using namespace std;
+
+static const char* kJsonTrailer = "\n]}\n";
+
+ModelWriter::ModelWriter(const Config& cfg,
+                         const string& fileName,
+                         const string& binaryFileName,
+                         bool sync)
+  : cfg_(cfg), sync_(sync), fp_(NULL), end_(0),
+    binFp_(NULL), countOffset_(0), numTrees_(0) {
+
+  if (!fileName.empty()) {
+    fp_ = fopen(fileName.c_str(), "w");
+    PCHECK(fp_ != NULL) << "can not open " << fileName;
+    fputs("{\"trees\": [", fp_);
+    end_ = ftell(fp_);
+    fputs(kJsonTrailer, fp_);
+    flush(fp_);
+  }
+
+  if (!binaryFileName.empty()) {
+    binFp_ = fopen(binaryFileName.c_str(), "wb");
+    PCHECK(binFp_ != NULL) << "can not open " << binaryFileName;
+    fwrite("GBMB", 1, 4, binFp_);
+    writeValue<uint32_t>(4);
+    writeValue<uint32_t>(cfg_.getNumFeatures());
+    for (int fid = 0; fid < cfg_.getNumFeatures(); fid++) {
+      const string& name = cfg_.getFeatureName(fid);
+      writeValue<uint32_t>(name.size());
+      fwrite(name.data(), 1, name.size(), binFp_);
+    }
+    countOffset_ = ftell(binFp_);
+    writeValue<uint32_t>(0);
+    flush(binFp_);
+  }
+}
+
+ModelWriter::~ModelWriter() {
+  if (fp_ != NULL) {
+    fclose(fp_);
+  }
+  if (binFp_ != NULL) {
+    fclose(binFp_);
+  }
+}
+
+void ModelWriter::flush(FILE* fp) {
+  fflush(fp);
+  if (sync_) {
+    fsync(fileno(fp));
+  }
+}
+
+void ModelWriter::addTree(const TreeNode<double>* rt) {
+  if (fp_ != NULL) {
+    // overwrite the trailer, then put it back after the new tree
+    fseek(fp_, end_, SEEK_SET);
+    fputs(numTrees_ == 0 ? "\n" : ",\n", fp_);
+    writeJson(rt);
+    end_ = ftell(fp_);
+    fputs(kJsonTrailer, fp_);
+    flush(fp_);
+  }
+
+  if (binFp_ != NULL) {
+    // the tree is complete on disk before it is counted
+    writeBinary(rt);
+    flush(binFp_);
+    const long end = ftell(binFp_);
+    fseek(binFp_, countOffset_, SEEK_SET);
+    writeValue<uint32_t>(numTrees_ + 1);
+    fseek(binFp_, end, SEEK_SET);
+    flush(binFp_);
+  }
+  numTrees_++;
+}
+
+void ModelWriter::writeJsonString(const string& s) {
+  fputc('"', fp_);
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', fp_);
+      fputc(c, fp_);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      fprintf(fp_, "\\u%04x", c);
+    } else {
+      fputc(c, fp_);
+    }
+  }
+  fputc('"', fp_);
+}
+
+// same fields as TreeNode::toJson
+void ModelWriter::writeJson(const TreeNode<double>* rt) {
+  const PartitionNode<double>* pnode =
+    dynamic_cast<const PartitionNode<double>*>(rt);
+  if (pnode == NULL) {
+    const LeafNode<double>* lfnode = dynamic_cast<const LeafNode<double>*>(rt);
+    fprintf(fp_, "{\"index\": -1, \"vote\": %.17g, \"count\": %" PRId64 "}",
+            lfnode->getVote(), lfnode->getCount());
+    return;
+  }
+
+  // splits that only separate the missing values are at infinity, written
+  // the way folly::parseJson reads it with allow_nan_inf
+  fprintf(fp_, "{\"index\": %d, \"value\": ", pnode->getFid());
+  if (std::isinf(pnode->getFv())) {
+    fputs(pnode->getFv() > 0 ? "Infinity" : "-Infinity", fp_);
+  } else {
+    fprintf(fp_, "%.17g", pnode->getFv());
+  }
+  fprintf(fp_, ", \"vote\": %.17g, "
+          "\"count\": %" PRId64 ", \"missing_left\": %s, \"feature\": ",
+          pnode->getVote(),
+          pnode->getCount(), pnode->isMissingLeft() ? "true" : "false");
+  writeJsonString(cfg_.getFeatureName(pnode->getFid()));
+  if (pnode->isCategorical()) {
+    fputs(", \"categories\": [", fp_);
+    const char* sep = "";
+    for (const int64_t c : pnode->getCategories().getList()) {
+      fprintf(fp_, "%s%" PRId64, sep, c);
+      sep = ", ";
+    }
+    fputc(']', fp_);
+  }
+  fputs(",\n \"left\": ", fp_);
+  writeJson(pnode->getLeft());
+  fputs(",\n \"right\": ", fp_);
+  writeJson(pnode->getRight());
+  fputc('}', fp_);
+}
+
+void ModelWriter::writeBinary(const TreeNode<double>* rt) {
+  FlatTree<double> tree(rt);
+  writeValue<uint32_t>(tree.getNodes().size());
+  for (const auto& node : tree.getNodes()) {
+    writeValue<int32_t>(node.fid);
+    writeValue<int32_t>(node.cold);
+    writeValue<uint8_t>(node.hotLeft);
+    writeValue<uint8_t>(node.missingLeft);
+    writeValue<double>(node.fv);
+    writeValue<double>(node.vote);
+    writeValue<uint8_t>(node.catSparse);
+    writeValue<uint32_t>(node.catSize);
+    for (int i = 0; i < node.catSize; i++) {
+      writeValue<uint64_t>(tree.getCategories()[node.catBegin + i]);
+    }
+  }
+}
+
+}
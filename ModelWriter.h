@@ -0,0 +1,83 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace boosting {
+
+class Config;
+template<class T> class TreeNode;
+
+// Writes a model tree by tree, as the trees are produced, to a json file
+// and/or a binary file of flat trees (see FlatTree), without building the
+// whole model in memory. After each tree both files hold a complete model
+// of the trees so far: the json trailer and the binary tree count are
+// rewritten in place, so partial models are usable while training runs.
+//
+// Binary format, in native byte order:
+//   "GBMB", uint32 version, uint32 #features, per feature: uint32 length
+//   and name; uint32 #trees, per tree: uint32 #nodes and per node: int32
+//   fid, int32 cold, uint8 hotLeft, uint8 missingLeft, double fv,
+//   double vote, uint8 catSparse, uint32 #words of the category set (0 for
+//   numerical splits) and the uint64 words: a bitset, or the sorted
+//   category ids if catSparse (see CategorySet)
+class ModelWriter {
+ public:
+  // empty file names are not written; with sync, each tree is fsync'd
+  ModelWriter(const Config& cfg,
+              const std::string& fileName,
+              const std::string& binaryFileName,
+              bool sync);
+
+  void addTree(const TreeNode<double>* rt);
+
+  ~ModelWriter();
+
+ private:
+  void writeJson(const TreeNode<double>* rt);
+
+  void writeJsonString(const std::string& s);
+
+  void writeBinary(const TreeNode<double>* rt);
+
+  template <class T>
+  void writeValue(const T& val) {
+    fwrite(&val, sizeof(val), 1, binFp_);
+  }
+
+  // flush fp, and make it durable if sync_
+  void flush(FILE* fp);
+
+  const Config& cfg_;
+  const bool sync_;
+
+  FILE* fp_;
+  long end_;           // end of the last tree in the json file
+
+  FILE* binFp_;
+  long countOffset_;   // offset of the tree count in the binary file
+
+  uint32_t numTrees_;
+};
+
+}
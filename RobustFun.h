@@ -0,0 +1,324 @@
+/* Copyright 2015,2016 Tao Xu
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "GbmFun.h"
+
+namespace boosting {
+
+// The alpha-quantile of values, selected in linear time: the value of rank
+// ceil(alpha * size) in increasing order. Reorders values.
+inline double selectQuantile(std::vector<double>* values, double alpha) {
+  const int k = std::max(0, int(ceil(alpha * values->size())) - 1);
+  std::nth_element(values->begin(), values->begin() + k, values->end());
+  return (*values)[k];
+}
+
+// Estimate of the alpha-quantile of a stream of values in constant memory,
+// with the P-square algorithm (Jain and Chlamtac, 1985): five markers at
+// the minimum, the alpha/2, alpha and (1+alpha)/2 quantiles and the
+// maximum are moved along with the ranks they should have, and their
+// heights adjusted by piecewise-parabolic interpolation.
+class StreamingQuantile {
+ public:
+  explicit StreamingQuantile(double alpha) : alpha_(alpha), count_(0) {
+    const double desired[] = {0.0, 2.0 * alpha, 4.0 * alpha,
+                              2.0 + 2.0 * alpha, 4.0};
+    const double increments[] = {0.0, alpha / 2.0, alpha,
+                                 (1.0 + alpha) / 2.0, 1.0};
+    for (int i = 0; i < 5; i++) {
+      ranks_[i] = i;
+      desired_[i] = desired[i];
+      increments_[i] = increments[i];
+    }
+  }
+
+  void add(double v) {
+    if (count_ < 5) {
+      heights_[count_++] = v;
+      std::sort(heights_, heights_ + count_);
+      return;
+    }
+    count_++;
+
+    // cell of v, extending the extreme markers if needed
+    int k;
+    if (v < heights_[0]) {
+      heights_[0] = v;
+      k = 0;
+    } else if (v >= heights_[4]) {
+      heights_[4] = v;
+      k = 3;
+    } else {
+      k = std::upper_bound(heights_, heights_ + 5, v) - heights_ - 1;
+    }
+    for (int i = k + 1; i < 5; i++) {
+      ranks_[i] += 1;
+    }
+    for (int i = 0; i < 5; i++) {
+      desired_[i] += increments_[i];
+    }
+
+    for (int i = 1; i < 4; i++) {
+      const double d = desired_[i] - ranks_[i];
+      if ((d >= 1.0 && ranks_[i + 1] - ranks_[i] > 1)
+          || (d <= -1.0 && ranks_[i - 1] - ranks_[i] < -1)) {
+        const int step = (d > 0) ? 1 : -1;
+        const double h = parabolic(i, step);
+        heights_[i] = (heights_[i - 1] < h && h < heights_[i + 1])
+          ? h
+          : heights_[i] + step * (heights_[i + step] - heights_[i])
+            / (ranks_[i + step] - ranks_[i]);
+        ranks_[i] += step;
+      }
+    }
+  }
+
+  bool empty() const {
+    return count_ == 0;
+  }
+
+  double get() const {
+    if (count_ < 5) {
+      const int k = std::max(0, int(ceil(alpha_ * count_)) - 1);
+      return heights_[k];
+    }
+    return heights_[2];
+  }
+
+ private:
+  double parabolic(int i, int d) const {
+    const double n0 = ranks_[i - 1], n1 = ranks_[i], n2 = ranks_[i + 1];
+    return heights_[i] + d / (n2 - n0)
+      * ((n1 - n0 + d) * (heights_[i + 1] - heights_[i]) / (n2 - n1)
+         + (n2 - n1 - d) * (heights_[i] - heights_[i - 1]) / (n1 - n0));
+  }
+
+  const double alpha_;
+  int64_t count_;
+  double heights_[5];
+  int64_t ranks_[5];
+  double desired_[5];
+  double increments_[5];
+};
+
+// Quantile regression: the loss of a residual r = y - f is alpha * r if
+// r >= 0, (alpha - 1) * r otherwise, so that the best constant is the
+// alpha-quantile (alpha = 0.5 for the least absolute deviation). Trees are
+// fit to the sign of the residuals, and each leaf predicts the quantile of
+// its residuals, saved by getGradient.
+class QuantileFun : public BlockGbmFun<QuantileFun> {
+ public:
+  explicit QuantileFun(double alpha)
+    : alpha_(alpha), numExamples_(0), loss_(0.0), baselineLoss_(0.0),
+      quantile_(alpha) {
+  }
+
+  double getLeafVal(const std::vector<int>& subset,
+                    const boost::scoped_array<double>& y) const {
+    std::vector<double> residuals;
+    residuals.reserve(subset.size());
+    for (const auto& id : subset) {
+      residuals.push_back(residuals_[id]);
+    }
+    return selectQuantile(&residuals, alpha_);
+  }
+
+  double getF0(const std::vector<double>& y) const {
+    std::vector<double> values(y);
+    return selectQuantile(&values, alpha_);
+  }
+
+  void getGradient(const std::vector<double>& y,
+                   const boost::scoped_array<double>& F,
+                   boost::scoped_array<double>& grad) const {
+    residuals_.resize(y.size());
+    for (int i = 0; i < y.size(); i++) {
+      residuals_[i] = y[i] - F[i];
+      grad[i] = getExampleGradient(y[i], F[i]);
+    }
+  }
+
+  double getExampleGradient(const double y, const double f) const {
+    return (y > f) ? alpha_ : alpha_ - 1.0;
+  }
+
+  double getInitLoss(const std::vector<double>& y) const {
+    const double f0 = getF0(y);
+    double loss = 0.0;
+    for (const auto yi : y) {
+      loss += getExampleLoss(yi, f0);
+    }
+    return loss;
+  }
+
+  double getExampleLoss(const double y, const double f) const {
+    const double r = y - f;
+    return (r >= 0) ? alpha_ * r : (alpha_ - 1.0) * r;
+  }
+
+  void accumulateExampleLoss(const double y, const double f) {
+    accumulateBlockLoss(&y, &f, 1);
+  }
+
+  // the baseline predicts each target by the quantile of the ones before,
+  // in a single pass
+  void accumulateBlockLoss(const double* y, const double* f, const int size) {
+    numExamples_ += size;
+    loss_ += getBlockLoss(y, f, size);
+    for (int i = 0; i < size; i++) {
+      if (!quantile_.empty()) {
+        baselineLoss_ += getExampleLoss(y[i], quantile_.get());
+      }
+      quantile_.add(y[i]);
+    }
+  }
+
+  double getReduction() const {
+    return 1.0 - loss_ / baselineLoss_;
+  }
+
+  int getNumExamples() const {
+    return numExamples_;
+  }
+
+  double getLoss() const {
+    return loss_;
+  }
+
+ private:
+  const double alpha_;
+  mutable std::vector<double> residuals_;  // of the last getGradient
+
+  int numExamples_;
+  double loss_;
+  double baselineLoss_;
+  StreamingQuantile quantile_;  // of the targets accumulated
+};
+
+// Huber loss: r^2 / 2 for a residual |r| <= delta, delta * (|r| - delta / 2)
+// otherwise. Trees are fit to the residuals clipped to [-delta, delta], and
+// each leaf predicts the median of its residuals plus the mean of their
+// clipped deviations from it (Friedman, 2001), from the residuals saved by
+// getGradient.
+class HuberFun : public BlockGbmFun<HuberFun> {
+ public:
+  explicit HuberFun(double delta)
+    : delta_(delta), numExamples_(0), loss_(0.0), baselineLoss_(0.0),
+      median_(0.5) {
+  }
+
+  double getLeafVal(const std::vector<int>& subset,
+                    const boost::scoped_array<double>& y) const {
+    std::vector<double> residuals;
+    residuals.reserve(subset.size());
+    for (const auto& id : subset) {
+      residuals.push_back(residuals_[id]);
+    }
+    const double median = selectQuantile(&residuals, 0.5);
+    double sum = 0.0;
+    for (const auto r : residuals) {
+      sum += clip(r - median);
+    }
+    return median + sum / residuals.size();
+  }
+
+  double getF0(const std::vector<double>& y) const {
+    std::vector<double> values(y);
+    return selectQuantile(&values, 0.5);
+  }
+
+  void getGradient(const std::vector<double>& y,
+                   const boost::scoped_array<double>& F,
+                   boost::scoped_array<double>& grad) const {
+    residuals_.resize(y.size());
+    for (int i = 0; i < y.size(); i++) {
+      residuals_[i] = y[i] - F[i];
+      grad[i] = getExampleGradient(y[i], F[i]);
+    }
+  }
+
+  double getExampleGradient(const double y, const double f) const {
+    return clip(y - f);
+  }
+
+  double getInitLoss(const std::vector<double>& y) const {
+    const double f0 = getF0(y);
+    double loss = 0.0;
+    for (const auto yi : y) {
+      loss += getExampleLoss(yi, f0);
+    }
+    return loss;
+  }
+
+  double getExampleLoss(const double y, const double f) const {
+    const double r = fabs(y - f);
+    return (r <= delta_) ? 0.5 * r * r : delta_ * (r - 0.5 * delta_);
+  }
+
+  void accumulateExampleLoss(const double y, const double f) {
+    accumulateBlockLoss(&y, &f, 1);
+  }
+
+  // the baseline predicts each target by the median of the ones before,
+  // as for QuantileFun
+  void accumulateBlockLoss(const double* y, const double* f, const int size) {
+    numExamples_ += size;
+    loss_ += getBlockLoss(y, f, size);
+    for (int i = 0; i < size; i++) {
+      if (!median_.empty()) {
+        baselineLoss_ += getExampleLoss(y[i], median_.get());
+      }
+      median_.add(y[i]);
+    }
+  }
+
+  double getReduction() const {
+    return 1.0 - loss_ / baselineLoss_;
+  }
+
+  int getNumExamples() const {
+    return numExamples_;
+  }
+
+  double getLoss() const {
+    return loss_;
+  }
+
+ private:
+  double clip(const double r) const {
+    return std::max(-delta_, std::min(delta_, r));
+  }
+
+  const double delta_;
+  mutable std::vector<double> residuals_;  // of the last getGradient
+
+  int numExamples_;
+  double loss_;
+  double baselineLoss_;
+  StreamingQuantile median_;  // of the targets accumulated
+};
+
+}
@@ -18,6 +18,8 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
@@ -27,14 +29,24 @@
 #include "boost/make_shared.hpp"
 #include "boost/shared_ptr.hpp"
 #include "boost/move/unique_ptr.hpp"
+#include "AsyncReader.h"
+#include "BinaryData.h"
+#include "Cascade.h"
 #include "Concurrency.h"
 #include "Config.h"
 #include "GbmFun.h"
 #include "Gbm.h"
+#include "Explainer.h"
+#include "LambdaFun.h"
 #include "LogisticFun.h"
+#include "ModelSimplifier.h"
+#include "Metrics.h"
+#include "ModelWriter.h"
+#include "RobustFun.h"
 #include "DataSet.h"
 #include "Tree.h"
 #include "gflags/gflags.h"
+#include "folly/Conv.h"
 #include "folly/String.h"
 #include "folly/json.h"
 #include "thrift/concurrency/PosixThreadFactory.h"
@@ -74,8 +86,69 @@ DEFINE_int32(num_examples_for_training, -1,
              "number of data points used for training, "
              " -1 will use all available");
 
+DEFINE_bool(optimize_layout, false,
+            "evaluate with trees laid out so that the most visited child "
+            "of each node follows it in memory");
+
+DEFINE_string(layout_profile_files, "",
+              "comma separated list of data files to count node visits on "
+              "for the tree layout, default to the training sample counts");
+
+DEFINE_string(binary_model_file, "",
+              "file to write the model in binary, with optimized layout");
+
+DEFINE_bool(cascade_eval, false,
+            "only decide whether each testing score exceeds "
+            "decision_threshold, evaluating trees until the remaining ones "
+            "can not change the decision; the eval output is 1 or 0");
+
+DEFINE_double(decision_threshold, 0.5,
+              "threshold of cascade_eval, a probability for the logistic "
+              "loss and a score otherwise");
+
+DEFINE_bool(sync_model_file, false,
+            "fsync the model files after each tree written, so that a "
+            "partially trained model survives a crash");
+
+DEFINE_bool(eval_auc, false,
+            "report the AUC of the testing scores, positive targets being "
+            "the positive class, from a fine histogram of the scores");
+
+DEFINE_bool(exact_auc, false,
+            "compute the testing AUC and precision/recall at k exactly, "
+            "keeping and sorting all the scores");
+
+DEFINE_string(eval_top_k, "",
+              "comma separated list of k to report the precision and "
+              "recall of the testing rows with the top k scores at");
+
+DEFINE_string(contributions_file, "",
+              "file to write the per feature contributions to the score "
+              "of each testing row");
+
+DEFINE_string(contribution_method, "saabas",
+              "saabas: changes of node votes along the evaluation path, "
+              "shap: exact SHAP values, using the node counts of the model");
+
+DEFINE_bool(simplify_model, false,
+            "simplify the model after training or loading it");
+
+DEFINE_double(simplify_vote_tolerance, 1e-6,
+              "collapse splits whose leaf votes differ by at most this");
+
+DEFINE_double(simplify_min_tree_vote, 1e-6,
+              "fold trees whose leaf votes are all below this into the bias");
+
+DEFINE_string(simplify_validation_files, "",
+              "comma separated list of data files to measure the score "
+              "deviation and evaluation time of the simplified model on");
+
 const int CHUNK_SIZE = 2500;  // # of lines each data loading chunk may parse
 
+const int LOAD_BATCH_CHUNKS = 256;  // # of chunks parsed together
+
+const int EVAL_BLOCK_SIZE = 1000;  // # of testing rows per loss block
+
 
 /**
  * Utility class used to parallelize dataset loading.
@@ -101,9 +174,11 @@ public:
     targets_.reserve(lines_.size());
     boost::scoped_array<double> farr(new double[cfg_.getNumFeatures()]);
     double target;
+    uint64_t query = 0;
     for (const string& line : lines_) {
-      if (dataSet_.getRow(line, &target, farr)) {
+      if (dataSet_.getRow(line, &target, farr, NULL, &query)) {
         targets_.push_back(target);
+        queries_.push_back(query);
         featureVectors_.emplace_back(farr.get(),
                                      farr.get() + cfg_.getNumFeatures());
       }
@@ -143,7 +218,7 @@ public:
     for (size_t i = 0; i < size; ++i) {
       const auto fvec = featureVectors_[i];
       copy(fvec.begin(), fvec.end(), farr.get());
-      if (!dataSet->addVector(farr, targets_[i])) {
+      if (!dataSet->addVector(farr, targets_[i], queries_[i])) {
         return i;
       }
     }
@@ -158,12 +233,13 @@ private:
   vector<string> lines_;
   vector<vector<double>> featureVectors_;
   vector<double> targets_;
+  vector<uint64_t> queries_;
 
 };
 
-// Divide training data file's lines into chunks,
-// and parse chunks concurrently if desired/possible
-void readIntoDataChunks(istream& in,
+// Divide the next lines of training data into up to LOAD_BATCH_CHUNKS
+// chunks, and parse chunks concurrently if desired/possible
+void readIntoDataChunks(AsyncReader* in,
                         vector<boost::shared_ptr<DataChunk>>* chunks,
                         size_t chunkSize, const Config& cfg,
                         const DataSet& dataSet) {
@@ -172,7 +248,7 @@ void readIntoDataChunks(istream& in,
   boost::shared_ptr<DataChunk> curChunkPtr =
     boost::make_shared<DataChunk>(cfg, dataSet, &monitor);
   string line;
-  while (getline(in, line)) {
+  while (chunks->size() < LOAD_BATCH_CHUNKS && in->getLine(&line)) {
     curChunkPtr->addLine(line);
     if (curChunkPtr->getLineBufferSize() >= chunkSize) {
       // filled up current chunk, so start another one
@@ -198,6 +274,51 @@ void readIntoDataChunks(istream& in,
   }
 }
 
+// load the rows of a binary data file (see BinaryData.h) into dataSet, its
+// columns matched to those of the config by name
+void loadBinaryFile(const string& fileName, const Config& cfg,
+                    DataSet* dataSet) {
+  BinaryDataReader reader(fileName);
+  const vector<string>& names = reader.getColumnNames();
+  auto getColumn = [&](int idx) {
+    const string& name = cfg.getColumnNames()[idx];
+    const auto it = find(names.begin(), names.end(), name);
+    CHECK(it != names.end()) << "no column " << name << " in " << fileName;
+    return int(it - names.begin());
+  };
+
+  // the train columns, then the target and the query columns
+  const int numFeatures = cfg.getNumFeatures();
+  vector<int> columns;
+  for (const int idx : cfg.getTrainIdx()) {
+    columns.push_back(getColumn(idx));
+  }
+  columns.push_back(getColumn(cfg.getTargetIdx()));
+  const bool byQuery = (cfg.getQueryIdx() != -1);
+  if (byQuery) {
+    columns.push_back(getColumn(cfg.getQueryIdx()));
+  }
+
+  boost::scoped_array<double> farr(new double[numFeatures]);
+  vector<vector<double>> values;
+  while (reader.readBlock(columns, &values)) {
+    const vector<double>& targets = values[numFeatures];
+    for (int r = 0; r < targets.size(); r++) {
+      for (int fid = 0; fid < numFeatures; fid++) {
+        farr[fid] = values[fid][r];
+      }
+      // the query ids are compared bit for bit
+      uint64_t query = 0;
+      if (byQuery) {
+        memcpy(&query, &values[numFeatures + 1][r], sizeof(query));
+      }
+      if (!dataSet->addVector(farr, dataSet->getTarget(targets[r]), query)) {
+        return;
+      }
+    }
+  }
+}
+
 // write feature importance vector
 void dumpFimps(const string& fileName, const Config& cfg, double fimps[]) {
   ofstream fs(fileName);
@@ -208,30 +329,144 @@ void dumpFimps(const string& fileName, const Config& cfg, double fimps[]) {
   fs.close();
 }
 
-// write Json dump of boosting model
-template <class T>
+// write the model to the json and/or binary model files, see ModelWriter
 void dumpModel(const string& fileName,
-	       const Config& cfg,
-               const vector<TreeNode<T>* >& model) {
-  folly::dynamic m = folly::dynamic::object;
-  folly::dynamic trees = {};
+               const string& binaryFileName,
+               const Config& cfg,
+               const vector<TreeNode<double>*>& model) {
+  ModelWriter writer(cfg, fileName, binaryFileName, FLAGS_sync_model_file);
+  for (const auto& t : model) {
+    writer.addTree(t);
+  }
+}
 
+// split a comma separated list of files
+vector<string> splitFiles(const string& files) {
+  vector<folly::StringPiece> sv;
+  folly::split(',', files, sv);
+  vector<string> fileNames;
+  for (const auto& s : sv) {
+    fileNames.push_back(s.str());
+  }
+  return fileNames;
+}
+
+// count node visits of the model on the rows of the given files, for the
+// layout only; the node counts of training are kept for SHAP values
+void profileModel(const string& files,
+                  const DataSet& ds,
+                  const Config& cfg,
+                  const vector<TreeNode<double>*>& model) {
   for (const auto& t : model) {
-    trees.push_back(std::move(t->toJson(cfg)));
+    resetVisits(t);
   }
 
-  m.insert("trees", trees);
+  double target;
+  boost::scoped_array<double> fvec(new double[cfg.getNumFeatures()]);
+  LOG(INFO) << "profiling model on:" << files;
+  AsyncReader reader(splitFiles(files));
+  string line;
+  while (reader.getLine(&line)) {
+    if (ds.getRow(line, &target, fvec)) {
+      for (const auto& t : model) {
+        countVisits(t, fvec);
+      }
+    }
+  }
+}
 
-  ofstream fs(fileName);
-  fs << toPrettyJson(m);
-  fs.close();
+// read all rows of the given files as feature vectors, concatenated
+void readRows(const string& files,
+              const DataSet& ds,
+              const Config& cfg,
+              vector<double>* rows) {
+  double target;
+  boost::scoped_array<double> fvec(new double[cfg.getNumFeatures()]);
+  AsyncReader reader(splitFiles(files));
+  string line;
+  while (reader.getLine(&line)) {
+    if (ds.getRow(line, &target, fvec)) {
+      rows->insert(rows->end(), fvec.get(), fvec.get() + cfg.getNumFeatures());
+    }
+  }
 }
 
-unique_ptr<GbmFun> getGbmFun(LossFunction loss) {
-  if (loss == L2Regression) {
-    return unique_ptr<GbmFun>(new LeastSquareFun());
-  } else {
-    return unique_ptr<GbmFun>(new LogisticFun());
+// score the rows, return the evaluation time in seconds
+double scoreRows(const vector<TreeNode<double>*>& model,
+                 const vector<double>& rows,
+                 const int numFeatures,
+                 vector<double>* scores) {
+  boost::scoped_array<double> fvec(new double[numFeatures]);
+  const int numRows = rows.size() / numFeatures;
+  scores->resize(numRows);
+
+  clock_t start = clock();
+  for (int i = 0; i < numRows; i++) {
+    copy(&rows[i * numFeatures], &rows[(i + 1) * numFeatures], fvec.get());
+    (*scores)[i] = predict(model, fvec);
+  }
+  return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void logModelSize(const string& name, const vector<TreeNode<double>*>& model) {
+  int numNodes = 0;
+  double comparisons = 0.0;
+  for (const auto& t : model) {
+    numNodes += getNumNodes(t);
+    comparisons += getExpectedComparisons(t);
+  }
+  LOG(INFO) << name << ": " << model.size() << " trees, " << numNodes
+            << " nodes, expected comparisons per row: " << comparisons;
+}
+
+// simplify the model (see ModelSimplifier), reporting the node count,
+// and the score deviation and evaluation time on the validation files
+void simplifyModel(const DataSet& ds,
+                   const Config& cfg,
+                   vector<TreeNode<double>*>* model) {
+  vector<double> rows;
+  vector<double> scores, newScores;
+  if (FLAGS_simplify_validation_files != "") {
+    readRows(FLAGS_simplify_validation_files, ds, cfg, &rows);
+  }
+
+  logModelSize("model before simplification", *model);
+  double time = scoreRows(*model, rows, cfg.getNumFeatures(), &scores);
+
+  ModelSimplifier simplifier(FLAGS_simplify_vote_tolerance,
+                             FLAGS_simplify_min_tree_vote);
+  simplifier.simplify(model);
+
+  logModelSize("model after simplification", *model);
+  double newTime = scoreRows(*model, rows, cfg.getNumFeatures(), &newScores);
+
+  if (!scores.empty()) {
+    double maxDev = 0.0, sumDev = 0.0;
+    for (int i = 0; i < scores.size(); i++) {
+      const double dev = fabs(scores[i] - newScores[i]);
+      maxDev = max(maxDev, dev);
+      sumDev += dev;
+    }
+    LOG(INFO) << "simplification on " << scores.size() << " rows: "
+              << "max score deviation " << maxDev
+              << ", mean score deviation " << sumDev / scores.size()
+              << ", eval time " << time << " -> " << newTime << " sec";
+  }
+}
+
+// queries: those of the training data, for the ranking losses
+unique_ptr<GbmFun> getGbmFun(const Config& cfg, const vector<int>& queries) {
+  switch (cfg.getLossFunction()) {
+    case L2Logistic:
+      return unique_ptr<GbmFun>(new LogisticFun());
+    case QuantileRegression:
+      return unique_ptr<GbmFun>(new QuantileFun(cfg.getQuantileAlpha()));
+    case HuberRegression:
+      return unique_ptr<GbmFun>(new HuberFun(cfg.getHuberDelta()));
+    case LambdaRank:
+      return unique_ptr<GbmFun>(new LambdaFun(queries));
+    default:
+      return unique_ptr<GbmFun>(new LeastSquareFun());
   }
 }
 
@@ -256,40 +491,63 @@ int main(int argc, char **argv) {
   LOG(INFO) << "loading config";
 
   CHECK(cfg.readConfig(FLAGS_config_file));
-  unique_ptr<GbmFun> pfun = getGbmFun(cfg.getLossFunction());
-  GbmFun& fun = *pfun;
-
-  unique_ptr<GbmFun> pCmpFun = getGbmFun(cfg.getLossFunction());
-  GbmFun& cmpFun = *pCmpFun;
-
   vector<TreeNode<double>*> model;
   DataSet ds(cfg, FLAGS_num_examples_for_bucketing,
              FLAGS_num_examples_for_training);
 
+  unique_ptr<GbmFun> pfun = getGbmFun(cfg, ds.getQueries());
+  GbmFun& fun = *pfun;
+
+  unique_ptr<GbmFun> pCmpFun = getGbmFun(cfg, ds.getQueries());
+  GbmFun& cmpFun = *pCmpFun;
+
   if (!FLAGS_eval_only) {
     // Compute model from training files
 
-    // First, load training files
-    vector<folly::StringPiece> sv;
-    folly::split(',', FLAGS_training_files, sv);
-
+    // First, load training files, reading ahead across files
     time_t start, end;
     time(&start);
 
-    for (const auto& s : sv) {
-      LOG(INFO) << "loading data from:" << s;
+    LOG(INFO) << "loading data from:" << FLAGS_training_files;
+    // the files are loaded in the order given, which decides the bucketing
+    // sample and the examples kept: binary files need no parsing, runs of
+    // text files are read ahead across files and parsed in chunks
+    auto loadTextFiles = [&](const vector<string>& files) {
+      AsyncReader reader(files);
+      while (true) {
+        vector<boost::shared_ptr<DataChunk>> dataChunks;
+        readIntoDataChunks(&reader, &dataChunks, CHUNK_SIZE, cfg, ds);
+        if (dataChunks.empty()) {
+          break;
+        }
+        for (const auto chunkPtr : dataChunks) {
+          chunkPtr->addToDataSet(&ds);
+        }
 
-      ifstream fs(s.str());
-      vector<boost::shared_ptr<DataChunk>> dataChunks;
-      readIntoDataChunks(fs, &dataChunks, CHUNK_SIZE, cfg, ds);
-      for (const auto chunkPtr : dataChunks) {
-        chunkPtr->addToDataSet(&ds);
+        time(&end);
+        double timespent = difftime(end, start);
+        LOG(INFO) << "read " << ds.getNumExamples() << " examples in "
+                  << timespent << " sec" << endl;
       }
+    };
 
+    vector<string> textFiles;
+    for (const auto& file : splitFiles(FLAGS_training_files)) {
+      if (!isBinaryDataFile(file)) {
+        textFiles.push_back(file);
+        continue;
+      }
+      if (!textFiles.empty()) {
+        loadTextFiles(textFiles);
+        textFiles.clear();
+      }
+      loadBinaryFile(file, cfg, &ds);
       time(&end);
-      double timespent = difftime(end, start);
       LOG(INFO) << "read " << ds.getNumExamples() << " examples in "
-                << timespent << " sec" << endl;
+                << difftime(end, start) << " sec" << endl;
+    }
+    if (!textFiles.empty()) {
+      loadTextFiles(textFiles);
     }
 
     ds.close();
@@ -300,11 +558,15 @@ int main(int argc, char **argv) {
     for (int i = 0; i < cfg.getNumFeatures(); i++) {
       fimps[i] = 0.0;
     }
-    engine.getModel(&model, fimps);
+    {
+      // the model files are written tree by tree, as they are built
+      ModelWriter writer(cfg, FLAGS_model_file, FLAGS_binary_model_file,
+                         FLAGS_sync_model_file);
+      engine.getModel(&model, fimps, &writer);
+    }
 
-    // Third, write the model files
+    // Third, write the feature importance
     dumpFimps(FLAGS_model_file + ".fimps", cfg, fimps);
-    dumpModel(FLAGS_model_file, cfg, model);
   } else {
     // Skip training, load previously written model
 
@@ -313,7 +575,10 @@ int main(int argc, char **argv) {
     stringstream buffer;
     buffer << fs.rdbuf();
 
-    const folly::dynamic obj = folly::parseJson(buffer.str());
+    // split values may be Infinity, see ModelWriter
+    folly::json::serialization_opts opts;
+    opts.allow_nan_inf = true;
+    const folly::dynamic obj = folly::parseJson(buffer.str(), opts);
     const int numTrees = obj["trees"].size();
     LOG(INFO) << "num trees: " << numTrees;
     model.reserve(numTrees);
@@ -322,6 +587,32 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (FLAGS_layout_profile_files != "") {
+    profileModel(FLAGS_layout_profile_files, ds, cfg, model);
+  }
+
+  if (FLAGS_simplify_model) {
+    simplifyModel(ds, cfg, &model);
+    if (!FLAGS_eval_only) {
+      dumpModel(FLAGS_model_file, "", cfg, model);
+    }
+  }
+
+  vector<FlatTree<double>> flatModel;
+  if (FLAGS_optimize_layout) {
+    for (const auto& t : model) {
+      flatModel.emplace_back(t);
+    }
+  }
+
+  // the binary model streamed during training is rewritten if the
+  // model or its layout changed since
+  if (FLAGS_binary_model_file != "" &&
+      (FLAGS_eval_only || FLAGS_simplify_model ||
+       FLAGS_layout_profile_files != "")) {
+    dumpModel("", FLAGS_binary_model_file, cfg, model);
+  }
+
   if (FLAGS_testing_files != "") {
     ostream *os = NULL;
     ofstream ofs;
@@ -342,58 +633,202 @@ int main(int argc, char **argv) {
 
     vector<unique_ptr<GbmFun>> funs;
     for (int i = 0; i < model.size(); i++) {
-      funs.push_back(getGbmFun(cfg.getLossFunction()));
+      funs.push_back(getGbmFun(cfg, ds.getQueries()));
     }
 
+    ofstream contribFs;
+    unique_ptr<Explainer> explainer;
+    if (FLAGS_contributions_file != "") {
+      contribFs.open(FLAGS_contributions_file);
+      explainer.reset(new Explainer(
+        model, cfg.getNumFeatures(),
+        FLAGS_contribution_method == "shap" ? TREE_SHAP : SAABAS));
+    }
+    const int numContribs = cfg.getNumFeatures() + 1;
+
+    unique_ptr<RankingMetrics> metrics;
+    if (FLAGS_eval_auc || FLAGS_exact_auc || FLAGS_eval_top_k != "") {
+      vector<folly::StringPiece> kv;
+      folly::split(',', FLAGS_eval_top_k, kv, true);
+      vector<int> ks;
+      for (const auto& k : kv) {
+        ks.push_back(folly::to<int>(k));
+        CHECK(ks.back() > 0) << "eval_top_k must be positive: " << k;
+      }
+      metrics.reset(new RankingMetrics(FLAGS_exact_auc, ks));
+    }
+
+    unique_ptr<Cascade> cascade;
+    int64_t cascadeTrees = 0, cascadeRows = 0, cascadePositives = 0;
+    if (FLAGS_cascade_eval) {
+      CHECK(!explainer && !FLAGS_find_optimal_num_trees && !metrics)
+        << "cascade_eval computes no scores";
+      // the logistic probability is 1 / (1 + exp(-2 * score))
+      const double threshold = (cfg.getLossFunction() == L2Logistic)
+        ? 0.5 * log(FLAGS_decision_threshold / (1.0 - FLAGS_decision_threshold))
+        : FLAGS_decision_threshold;
+      cascade.reset(new Cascade(model, threshold));
+    }
+
+    // rows are processed one block at a time: losses are accumulated per
+    // block, and with an explainer the rows are scored and attributed in
+    // parallel. treeScores holds the scores after each tree, row-major, for
+    // find_optimal_num_trees. With a query column, blocks end at the end of
+    // a query, and the losses are accumulated query by query, queryStarts
+    // holding the first row of each query of the block
+    const bool byQuery = cfg.hasQueries();
+    vector<string> lines;
+    vector<double> targets, fscores, cmpScores;
+    vector<double> rows, contribs;
+    vector<double> treeScores, scoresOfTree;
+    vector<int> queryStarts;
+    uint64_t query = 0, lastQuery = 0;
+    auto accumulateLoss = [&](GbmFun* f, const double* scores) {
+      const int size = targets.size();
+      if (!byQuery) {
+        f->accumulateBlockLoss(targets.data(), scores, size);
+        return;
+      }
+      for (int q = 0; q < queryStarts.size(); q++) {
+        const int begin = queryStarts[q];
+        const int end = (q + 1 < queryStarts.size()) ? queryStarts[q + 1] : size;
+        f->accumulateBlockLoss(&targets[begin], &scores[begin], end - begin);
+      }
+    };
+    auto processBlock = [&]() {
+      const int size = targets.size();
+      if (explainer) {
+        fscores.resize(size);
+        contribs.resize(size * numContribs);
+        explainer->explain(rows.data(), size, fscores.data(), contribs.data());
+      }
+
+      for (int r = 0; r < size; r++) {
+        if (os != NULL) {
+          ds.getEvalColumns(lines[r], feval);
+          for (int i = 0; i < numEvalColumns; i++) {
+            (*os) << feval[i] << '\t';
+          }
+          (*os) << fscores[r] << '\n';
+        }
+        if (explainer) {
+          // non-zero contributions only, as feature:contribution
+          const double* contrib = &contribs[r * numContribs];
+          contribFs << fscores[r] << '\t' << "bias:" << contrib[numContribs - 1];
+          for (int fid = 0; fid < cfg.getNumFeatures(); fid++) {
+            if (contrib[fid] != 0.0) {
+              contribFs << '\t' << cfg.getFeatureName(fid) << ':' << contrib[fid];
+            }
+          }
+          contribFs << '\n';
+        }
+      }
+
+      if (!cascade) {
+        accumulateLoss(&fun, fscores.data());
+      }
+      if (metrics) {
+        metrics->add(targets.data(), fscores.data(), size);
+      }
+      accumulateLoss(&cmpFun, cmpScores.data());
+      if (FLAGS_find_optimal_num_trees) {
+        scoresOfTree.resize(size);
+        for (int i = 0; i < model.size(); i++) {
+          for (int r = 0; r < size; r++) {
+            scoresOfTree[r] = treeScores[r * model.size() + i];
+          }
+          accumulateLoss(funs[i].get(), scoresOfTree.data());
+        }
+      }
+      lines.clear();
+      targets.clear();
+      fscores.clear();
+      cmpScores.clear();
+      rows.clear();
+      treeScores.clear();
+      queryStarts.clear();
+    };
+    // the cascade computes no scores, hence no loss: its decisions are
+    // reported instead
+    auto logCascade = [&]() {
+      if (cascadeRows > 0) {
+        LOG(INFO) << "cascade eval: " << cascadePositives << " of "
+                  << cascadeRows << " rows above threshold, avg trees "
+                  << "evaluated per row: "
+                  << double(cascadeTrees) / cascadeRows
+                  << " of " << model.size();
+      }
+    };
+    auto logLoss = [&]() {
+      if (cascade) {
+        logCascade();
+        return;
+      }
+      LOG(INFO) << "test loss reduction: " << fun.getReduction()
+                << " on num examples: " << fun.getNumExamples()
+                << " total loss: " << fun.getLoss()
+                << " logged score: " << score
+                << " cmp loss: " << cmpFun.getLoss()
+                << " cmp reduction: " << cmpFun.getReduction();
+    };
+
     vector<folly::StringPiece> tsv;
     folly::split(',', FLAGS_testing_files, tsv);
     for (const auto& s : tsv) {
       LOG(INFO) << "loading data from:" << s;
-      istream *is;
-      fstream fs;
-
-      if (s.str() == "stdin") {
-        is = &cin;
-      } else {
-        fs.open(s.str());
-        is = &fs;
+      // stdin can not be read ahead, files are
+      unique_ptr<AsyncReader> reader;
+      if (s.str() != "stdin") {
+        reader.reset(new AsyncReader({s.str()}));
       }
       string line;
       vector<double> scores;
-      while(getline(*is, line)) {
-        ds.getRow(line, &target, fvec, &score);
-        double f;
-        if (FLAGS_find_optimal_num_trees) {
-          f = predict_vec(model, fvec, &scores);
-          for (int i = 0; i < model.size(); i++) {
-            funs[i]->accumulateExampleLoss(target, scores[i]);
+      while (reader ? reader->getLine(&line) : bool(getline(cin, line))) {
+        ds.getRow(line, &target, fvec, &score, &query);
+        if (byQuery && (targets.empty() || query != lastQuery)) {
+          if (targets.size() >= EVAL_BLOCK_SIZE) {
+            processBlock();
+            logLoss();
           }
+          queryStarts.push_back(targets.size());
+          lastQuery = query;
+        }
+        double f = 0.0;
+        if (explainer) {
+          // scored and attributed with the whole block
+          rows.insert(rows.end(), fvec.get(), fvec.get() + cfg.getNumFeatures());
+        }
+        if (FLAGS_find_optimal_num_trees) {
+          f = FLAGS_optimize_layout
+            ? predict_vec(flatModel, fvec, &scores)
+            : predict_vec(model, fvec, &scores);
+          treeScores.insert(treeScores.end(), scores.begin(), scores.end());
           scores.clear();
-        } else {
-          f = predict(model, fvec);
+        } else if (cascade) {
+          int numTrees;
+          f = cascade->decide(fvec.get(), &numTrees) ? 1.0 : 0.0;
+          cascadeTrees += numTrees;
+          cascadeRows++;
+          cascadePositives += (f > 0.0);
+        } else if (!explainer) {
+          f = FLAGS_optimize_layout
+            ? predict(flatModel, fvec) : predict(model, fvec);
         }
 
-	if (os != NULL) {
-	  ds.getEvalColumns(line, feval);
-	  for (int i = 0; i < numEvalColumns; i++) {
-	    (*os) << feval[i] << '\t';
-	  }
-	  (*os) << f << endl;
-	}
-
-	fun.accumulateExampleLoss(target, f);
-        cmpFun.accumulateExampleLoss(target, score);
-	if (fun.getNumExamples() % 1000 == 0) {
-	  LOG(INFO) << "test loss reduction: " << fun.getReduction()
-		    << " on num examples: " << fun.getNumExamples()
-		    << " total loss: " << fun.getLoss()
-		    << " logged score: " << score
-		    << " computed score: " << f
-                    << " cmp loss: " << cmpFun.getLoss()
-                    << " cmp reduction: " << cmpFun.getReduction();
-	}
+        if (os != NULL) {
+          lines.push_back(line);
+        }
+        targets.push_back(target);
+        fscores.push_back(f);
+        cmpScores.push_back(score);
+        if (!byQuery && targets.size() == EVAL_BLOCK_SIZE) {
+          processBlock();
+          logLoss();
+        }
       }
     }
+    processBlock();
+
     if (os != NULL) {
       os->flush();
     }
@@ -405,12 +840,29 @@ int main(int argc, char **argv) {
       }
     }
 
-    LOG(INFO) << fun.getNumExamples() << '\t' << fun.getReduction() << '\t'
-	      << fun.getLoss() << endl;
+    if (cascade) {
+      logCascade();
+    }
 
-    LOG(INFO) << "test loss reduction: " << fun.getReduction()
-              << ", cmp loss function: " << cmpFun.getReduction()
-	      << " on num examples: " << fun.getNumExamples();
+    if (metrics) {
+      metrics->finish();
+      LOG(INFO) << "test auc: " << metrics->getAuc() << " on num examples: "
+                << metrics->getNumExamples();
+      for (int i = 0; i < metrics->getKs().size(); i++) {
+        LOG(INFO) << "test precision at " << metrics->getKs()[i] << ": "
+                  << metrics->getPrecision(i) << ", recall: "
+                  << metrics->getRecall(i);
+      }
+    }
+
+    if (!cascade) {
+      LOG(INFO) << fun.getNumExamples() << '\t' << fun.getReduction() << '\t'
+                << fun.getLoss() << endl;
+
+      LOG(INFO) << "test loss reduction: " << fun.getReduction()
+                << ", cmp loss function: " << cmpFun.getReduction()
+                << " on num examples: " << fun.getNumExamples();
+    }
 
   }
 }
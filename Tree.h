@@ -19,7 +19,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <boost/scoped_array.hpp>
+#include <cmath>
+#include <cstdint>
+#include <vector>
 
 #include "folly/json.h"
 #include "folly/Conv.h"
@@ -27,12 +31,135 @@
 
 namespace boosting {
 
+// missing feature values are NaN; bucketized values are compared to the
+// missing bucket of their feature instead (see FeatureData)
+inline bool isMissing(double x) {
+  return std::isnan(x);
+}
+
+inline bool isMissing(uint16_t x) {
+  return false;
+}
+
+// whether x is one of the categories of the bitset, or of the sorted ids
+// if sparse; values that are not category ids, i.e. non-negative
+// integers, are in no set
+template <class T>
+inline bool hasCategory(const uint64_t* categories, int size, bool sparse,
+                        T x) {
+  if (sparse) {
+    if (!(x >= 0) || x > categories[size - 1]) {
+      return false;
+    }
+    const uint64_t c = static_cast<uint64_t>(x);
+    return c == x && std::binary_search(categories, categories + size, c);
+  }
+  if (!(x >= 0) || x >= 64.0 * size) {
+    return false;
+  }
+  const uint64_t c = static_cast<uint64_t>(x);
+  return c == x && ((categories[c >> 6] >> (c & 63)) & 1);
+}
+
+inline void addCategory(std::vector<uint64_t>* categories, uint64_t c) {
+  if (categories->size() <= (c >> 6)) {
+    categories->resize((c >> 6) + 1, 0);
+  }
+  (*categories)[c >> 6] |= uint64_t(1) << (c & 63);
+}
+
+// the categories of a bitset, in increasing order
+inline std::vector<int64_t> getCategoryList(
+  const std::vector<uint64_t>& categories) {
+
+  std::vector<int64_t> list;
+  for (int64_t c = 0; c < 64 * int64_t(categories.size()); c++) {
+    if ((categories[c >> 6] >> (c & 63)) & 1) {
+      list.push_back(c);
+    }
+  }
+  return list;
+}
+
+// The categories going left at a categorical split: a bitset while all
+// ids are below 64 * kMaxDenseWords, the sorted ids otherwise, so that a
+// few large ids cost a word each rather than a bitset up to the largest.
+// Never empty: an empty set is a bitset of one zero word.
+class CategorySet {
+ public:
+  static const int kMaxDenseWords = 64;
+
+  CategorySet() : sparse_(false), words_(1, 0) {
+  }
+
+  // the buckets of a bitset
+  explicit CategorySet(const std::vector<uint64_t>& bitset)
+    : sparse_(false), words_(bitset) {
+    if (words_.empty()) {
+      words_.assign(1, 0);
+    } else if (words_.size() > kMaxDenseWords) {
+      toSparse();
+    }
+  }
+
+  void add(uint64_t c) {
+    if (!sparse_ && c < 64 * uint64_t(kMaxDenseWords)) {
+      addCategory(&words_, c);
+      return;
+    }
+    if (!sparse_) {
+      toSparse();
+    }
+    const auto it = std::lower_bound(words_.begin(), words_.end(), c);
+    if (it == words_.end() || *it != c) {
+      words_.insert(it, c);
+    }
+  }
+
+  template <class T>
+  bool contains(T x) const {
+    return hasCategory(words_.data(), words_.size(), sparse_, x);
+  }
+
+  bool isSparse() const {
+    return sparse_;
+  }
+
+  // the words of the bitset, or the sorted ids if sparse
+  const std::vector<uint64_t>& getWords() const {
+    return words_;
+  }
+
+  // the categories in increasing order
+  std::vector<int64_t> getList() const {
+    return sparse_ ? std::vector<int64_t>(words_.begin(), words_.end())
+      : getCategoryList(words_);
+  }
+
+ private:
+  void toSparse() {
+    const std::vector<int64_t> list = getCategoryList(words_);
+    words_.assign(list.begin(), list.end());
+    sparse_ = true;
+  }
+
+  bool sparse_;
+  std::vector<uint64_t> words_;
+};
+
 template <class T>
 class TreeNode {
  public:
   virtual double eval(const boost::scoped_array<T>& fvec) const = 0;
   virtual void scale(double w) = 0;
   virtual folly::dynamic toJson(const Config& cfg) const = 0;
+  // number of examples visiting the node, from the training sample
+  virtual int64_t getCount() const = 0;
+  virtual void setCount(int64_t count) = 0;
+  // number of rows visiting the node when profiled (see countVisits), -1
+  // if not; only orders the tree layout, the counts stay those of training
+  virtual int64_t getVisits() const = 0;
+  virtual void setVisits(int64_t visits) = 0;
   virtual ~TreeNode() {}
 };
 
@@ -40,7 +167,8 @@ template <class T>
 class PartitionNode : public TreeNode<T> {
  public:
   PartitionNode(int fid, T fv)
-    : fid_(fid), fv_(fv), fvote_(0.0),
+    : fid_(fid), fv_(fv), fvote_(0.0), count_(0), visits_(-1),
+    missingLeft_(false), categorical_(false),
     left_(NULL), right_(NULL) {
   }
 
@@ -76,8 +204,55 @@ class PartitionNode : public TreeNode<T> {
     fvote_ = fvote;
   }
 
+  int64_t getCount() const {
+    return count_;
+  }
+
+  void setCount(int64_t count) {
+    count_ = count;
+  }
+
+  int64_t getVisits() const {
+    return visits_;
+  }
+
+  void setVisits(int64_t visits) {
+    visits_ = visits;
+  }
+
+  // whether missing values go left, they go right otherwise
+  bool isMissingLeft() const {
+    return missingLeft_;
+  }
+
+  void setMissingLeft(bool missingLeft) {
+    missingLeft_ = missingLeft;
+  }
+
+  // a categorical split sends the categories of its set left and all
+  // others right, a numerical one compares to fv
+  bool isCategorical() const {
+    return categorical_;
+  }
+
+  const CategorySet& getCategories() const {
+    return categories_;
+  }
+
+  void setCategories(const CategorySet& categories) {
+    categories_ = categories;
+    categorical_ = true;
+  }
+
+  bool goLeft(T x) const {
+    if (categorical_) {
+      return isMissing(x) ? missingLeft_ : categories_.contains(x);
+    }
+    return x <= fv_ || (missingLeft_ && isMissing(x));
+  }
+
   double eval(const boost::scoped_array<T>& fvec) const {
-    if (fvec[fid_] <= fv_) {
+    if (goLeft(fvec[fid_])) {
       return left_->eval(fvec);
     } else {
       return right_->eval(fvec);
@@ -98,6 +273,15 @@ class PartitionNode : public TreeNode<T> {
     m.insert("left", left_->toJson(cfg));
     m.insert("right", right_->toJson(cfg));
     m.insert("vote", fvote_);
+    m.insert("count", count_);
+    m.insert("missing_left", missingLeft_);
+    if (isCategorical()) {
+      folly::dynamic list = {};
+      for (const int64_t c : categories_.getList()) {
+        list.push_back(c);
+      }
+      m.insert("categories", list);
+    }
     m.insert("feature", cfg.getFeatureName(fid_));
     return m;
   }
@@ -111,6 +295,11 @@ class PartitionNode : public TreeNode<T> {
   int fid_;
   T fv_;
   double fvote_;
+  int64_t count_;
+  int64_t visits_;
+  bool missingLeft_;
+  bool categorical_;
+  CategorySet categories_;
 
   TreeNode<T>* left_;
   TreeNode<T>* right_;
@@ -119,7 +308,7 @@ class PartitionNode : public TreeNode<T> {
 template <class T>
 class LeafNode : public TreeNode<T> {
  public:
-  explicit LeafNode(double fvote) : fvote_(fvote) {
+  explicit LeafNode(double fvote) : fvote_(fvote), count_(0), visits_(-1) {
   }
 
   double eval(const boost::scoped_array<T>& fvec) const {
@@ -130,6 +319,22 @@ class LeafNode : public TreeNode<T> {
     return fvote_;
   }
 
+  int64_t getCount() const {
+    return count_;
+  }
+
+  void setCount(int64_t count) {
+    count_ = count;
+  }
+
+  int64_t getVisits() const {
+    return visits_;
+  }
+
+  void setVisits(int64_t visits) {
+    visits_ = visits;
+  }
+
   void scale(double w) {
     fvote_ *= w;
   }
@@ -139,6 +344,7 @@ class LeafNode : public TreeNode<T> {
 
     m.insert("index", -1);
     m.insert("vote", fvote_);
+    m.insert("count", count_);
     return m;
   }
 
@@ -147,6 +353,8 @@ class LeafNode : public TreeNode<T> {
 
  private:
   double fvote_;
+  int64_t count_;
+  int64_t visits_;
 };
 
 // load a regression tree from Json
@@ -159,9 +367,12 @@ TreeNode<T>* fromJson(const folly::dynamic& obj, const Config& cfg) {
   }
 
   double vote = static_cast<T>(obj["vote"].asDouble());
+  // older models carry no node counts
+  const folly::dynamic* count = obj.get_ptr("count");
 
+  TreeNode<T>* rt;
   if (!feature) {
-    return new LeafNode<T>(vote);
+    rt = new LeafNode<T>(vote);
   } else {
     std::string featureName = feature->asString().toStdString();
     int index = cfg.getFeatureIndex(featureName);
@@ -172,14 +383,180 @@ TreeNode<T>* fromJson(const folly::dynamic& obj, const Config& cfg) {
     } else {
       value = static_cast<T>(obj["value"].asDouble());
     }
-    PartitionNode<T>* rt = new PartitionNode<T>(index, value);
-    rt->setLeft(fromJson<T>(obj["left"], cfg));
-    rt->setRight(fromJson<T>(obj["right"], cfg));
-    rt->setVote(vote);
-    return rt;
+    PartitionNode<T>* pnode = new PartitionNode<T>(index, value);
+    pnode->setLeft(fromJson<T>(obj["left"], cfg));
+    pnode->setRight(fromJson<T>(obj["right"], cfg));
+    pnode->setVote(vote);
+    const folly::dynamic* missingLeft = obj.get_ptr("missing_left");
+    if (missingLeft != nullptr) {
+      pnode->setMissingLeft(missingLeft->asBool());
+    }
+    const folly::dynamic* categories = obj.get_ptr("categories");
+    if (categories != nullptr) {
+      CategorySet set;
+      for (const auto& c : *categories) {
+        set.add(c.asInt());
+      }
+      pnode->setCategories(set);
+    }
+    rt = pnode;
+  }
+  if (count != nullptr) {
+    rt->setCount(count->asInt());
+  }
+  return rt;
+}
+
+// set the visits of every node of the tree to 0, before profiling
+template <class T>
+void resetVisits(TreeNode<T>* rt) {
+  rt->setVisits(0);
+  PartitionNode<T>* pnode = dynamic_cast<PartitionNode<T>*>(rt);
+  if (pnode != NULL) {
+    resetVisits(pnode->getLeft());
+    resetVisits(pnode->getRight());
+  }
+}
+
+// increment the visits of every node on the evaluation path of fvec
+template <class T>
+void countVisits(TreeNode<T>* rt, const boost::scoped_array<T>& fvec) {
+  PartitionNode<T>* pnode;
+  while ((pnode = dynamic_cast<PartitionNode<T>*>(rt)) != NULL) {
+    pnode->setVisits(pnode->getVisits() + 1);
+    if (pnode->goLeft(fvec[pnode->getFid()])) {
+      rt = pnode->getLeft();
+    } else {
+      rt = pnode->getRight();
+    }
   }
+  rt->setVisits(rt->getVisits() + 1);
 }
 
+template <class T>
+int getNumNodes(const TreeNode<T>* rt) {
+  const PartitionNode<T>* pnode = dynamic_cast<const PartitionNode<T>*>(rt);
+  if (pnode == NULL) {
+    return 1;
+  }
+  return 1 + getNumNodes(pnode->getLeft()) + getNumNodes(pnode->getRight());
+}
+
+// expected number of comparisons to evaluate a row, with branch
+// probabilities estimated from the node counts (even if there are none)
+template <class T>
+double getExpectedComparisons(const TreeNode<T>* rt) {
+  const PartitionNode<T>* pnode = dynamic_cast<const PartitionNode<T>*>(rt);
+  if (pnode == NULL) {
+    return 0.0;
+  }
+  const double cntLeft = pnode->getLeft()->getCount();
+  const double cntRight = pnode->getRight()->getCount();
+  const double probLeft = (cntLeft + cntRight > 0)
+    ? cntLeft / (cntLeft + cntRight) : 0.5;
+  return 1.0 + probLeft * getExpectedComparisons(pnode->getLeft())
+    + (1.0 - probLeft) * getExpectedComparisons(pnode->getRight());
+}
+
+// A tree stored contiguously for fast evaluation. Nodes are laid out in
+// preorder with the more visited child of every partition node placed
+// right after it, so the hot path is a forward walk through the array and
+// only the less likely branch jumps.
+template <class T>
+class FlatTree {
+ public:
+  struct Node {
+    int fid;       // feature of a partition node, -1 for leaves
+    int cold;      // index of the less visited child
+    bool hotLeft;  // whether the child at index + 1 is the left one
+    bool missingLeft;
+    int catBegin;  // category set of a categorical split, in getCategories()
+    int catSize;   // number of words of the set, 0 for numerical splits
+    bool catSparse;  // whether the words are sorted ids, see CategorySet
+    T fv;
+    double vote;
+    int64_t count;
+  };
+
+  explicit FlatTree(const TreeNode<T>* rt) {
+    layout(rt);
+  }
+
+  double eval(const T* fvec) const {
+    int idx = 0;
+    while (nodes_[idx].fid >= 0) {
+      const Node& node = nodes_[idx];
+      idx = (goLeft(node, fvec[node.fid]) == node.hotLeft) ? idx + 1 : node.cold;
+    }
+    return nodes_[idx].vote;
+  }
+
+  bool goLeft(const Node& node, T x) const {
+    if (node.catSize > 0) {
+      return isMissing(x) ? node.missingLeft
+        : hasCategory(&categories_[node.catBegin], node.catSize,
+                      node.catSparse, x);
+    }
+    return x <= node.fv || (node.missingLeft && isMissing(x));
+  }
+
+  const std::vector<Node>& getNodes() const {
+    return nodes_;
+  }
+
+  const std::vector<uint64_t>& getCategories() const {
+    return categories_;
+  }
+
+ private:
+  void layout(const TreeNode<T>* rt) {
+    const int idx = nodes_.size();
+    nodes_.push_back(Node());
+    Node& node = nodes_.back();
+    node.cold = -1;
+    node.hotLeft = true;
+    node.missingLeft = false;
+    node.catBegin = 0;
+    node.catSize = 0;
+    node.catSparse = false;
+    node.count = rt->getCount();
+
+    const PartitionNode<T>* pnode =
+      dynamic_cast<const PartitionNode<T>*>(rt);
+    if (pnode == NULL) {
+      node.fid = -1;
+      node.fv = T();
+      node.vote = dynamic_cast<const LeafNode<T>*>(rt)->getVote();
+      return;
+    }
+    node.fid = pnode->getFid();
+    node.fv = pnode->getFv();
+    node.vote = pnode->getVote();
+    node.missingLeft = pnode->isMissingLeft();
+    if (pnode->isCategorical()) {
+      const auto& words = pnode->getCategories().getWords();
+      node.catBegin = categories_.size();
+      node.catSize = words.size();
+      node.catSparse = pnode->getCategories().isSparse();
+      categories_.insert(categories_.end(), words.begin(), words.end());
+    }
+    // the profiled visits if any, the training counts otherwise
+    const TreeNode<T>* left = pnode->getLeft();
+    const TreeNode<T>* right = pnode->getRight();
+    node.hotLeft = (left->getVisits() >= 0 && right->getVisits() >= 0)
+      ? left->getVisits() >= right->getVisits()
+      : left->getCount() >= right->getCount();
+
+    // node may be invalidated by the recursion, always go through idx
+    layout(nodes_[idx].hotLeft ? pnode->getLeft() : pnode->getRight());
+    nodes_[idx].cold = nodes_.size();
+    layout(nodes_[idx].hotLeft ? pnode->getRight() : pnode->getLeft());
+  }
+
+  std::vector<Node> nodes_;
+  std::vector<uint64_t> categories_;
+};
+
 template <class T>
   double predict(const std::vector<TreeNode<T>*>& models,
                  const boost::scoped_array<T>& fvec) {
@@ -204,5 +581,28 @@ template <class T>
   return f;
 }
 
+template <class T>
+  double predict(const std::vector<FlatTree<T>>& models,
+                 const boost::scoped_array<T>& fvec) {
+
+  double f = 0.0;
+  for (const auto& m : models) {
+    f += m.eval(fvec.get());
+  }
+  return f;
+}
+
+template <class T>
+  double predict_vec(const std::vector<FlatTree<T>>& models,
+                     const boost::scoped_array<T>& fvec,
+                     std::vector<double>* score) {
+
+  double f = 0.0;
+  for (const auto& m : models) {
+    f += m.eval(fvec.get());
+    score->push_back(f);
+  }
+  return f;
+}
 
 }
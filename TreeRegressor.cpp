@@ -19,10 +19,14 @@
 
 #include "TreeRegressor.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <limits>
+#include <memory>
 #include <boost/random/uniform_real.hpp>
 
+#include "Concurrency.h"
+#include "Config.h"
 #include "Tree.h"
 #include "GbmFun.h"
 #include "DataSet.h"
@@ -32,6 +36,24 @@
 DEFINE_int32(min_leaf_examples, 256,
              "minimum number of data points in the leaf");
 
+DEFINE_int32(max_depth, -1,
+             "maximum depth of the trees, -1 for unlimited");
+
+DEFINE_double(coarse_histogram_max_density, 2.0,
+              "in nodes with fewer examples per bucket than this, numerical "
+              "features stored as shorts find their splits from a coarse "
+              "histogram refined around the best coarse splits, 0 to always "
+              "build dense histograms");
+
+DEFINE_int32(coarse_histogram_candidates, 8,
+             "number of best coarse splits whose coarse buckets on either "
+             "side are refined into fine buckets");
+
+DEFINE_double(max_expected_comparisons, -1.0,
+              "maximum expected number of comparisons to evaluate a row "
+              "with a tree, estimated from the number of examples in each "
+              "node, -1 for unlimited");
+
 namespace boosting {
 
 using namespace std;
@@ -46,8 +68,11 @@ inline bool biasedCoinFlip(double probabilityOfTrue) {
   return (rand() < probabilityOfTrue * RAND_MAX);
 }
 
-TreeRegressor::SplitNode::SplitNode(const vector<int>* st):
-  subset(st), fid(-1), fv(0), gain(0), selected(false),
+TreeRegressor::SplitNode::SplitNode(const vector<int>* st,
+                                    const vector<double>* yv,
+                                    int dp):
+  subset(st), ys(yv), depth(dp), fid(-1), fv(0), missingLeft(false), gain(0),
+  score(0), vote(0), selected(false),
   left(NULL), right(NULL) {
 }
 
@@ -73,17 +98,64 @@ void TreeRegressor::splitExamples(
 
   auto &f = ds_.features_[fid];
 
-  if (f.encoding == BYTE) {
-    boosting::split<uint8_t>(*(split.subset), left, right, *(f.bvec), fv);
+  if (!split.categories.empty()) {
+    if (f.encoding == BYTE) {
+      boosting::splitCategories<uint8_t>(*(split.subset), left, right,
+                                         *(f.bvec), split.categories);
+    } else if (f.encoding == PACKED) {
+      boosting::splitCategories(*(split.subset), left, right,
+                                *(f.pvec), split.categories);
+    } else {
+      CHECK(f.encoding == SHORT);
+      boosting::splitCategories<uint16_t>(*(split.subset), left, right,
+                                          *(f.svec), split.categories);
+    }
+  } else if (f.encoding == BYTE) {
+    boosting::split<uint8_t>(*(split.subset), left, right, *(f.bvec), fv,
+                             f.getMissingBucket(), split.missingLeft);
+  } else if (f.encoding == PACKED) {
+    boosting::split(*(split.subset), left, right, *(f.pvec), fv,
+                    f.getMissingBucket(), split.missingLeft);
   } else {
     CHECK(f.encoding == SHORT);
-    boosting::split<uint16_t>(*(split.subset), left, right, *(f.svec), fv);
+    boosting::split<uint16_t>(*(split.subset), left, right, *(f.svec), fv,
+                              f.getMissingBucket(), split.missingLeft);
   }
 }
 
+void TreeRegressor::splitValues(const vector<int>& subset,
+                                const vector<double>& ys,
+                                const vector<int>& left,
+                                vector<double>* leftYs,
+                                vector<double>* rightYs) {
+  leftYs->reserve(left.size());
+  rightYs->reserve(subset.size() - left.size());
+  size_t j = 0;
+  for (size_t i = 0; i < subset.size(); i++) {
+    if (j < left.size() && subset[i] == left[j]) {
+      leftYs->push_back(ys[i]);
+      j++;
+    } else {
+      rightYs->push_back(ys[i]);
+    }
+  }
+}
+
+void TreeRegressor::buildHistogram(const vector<int>& subset,
+                                   const vector<double>& ys,
+                                   const PackedVector& fvec,
+                                   Histogram& hist) {
+  size_t i = 0;
+  forEachPacked(subset, fvec, [&](int id, uint16_t v) {
+      hist.cnt[v] += 1;
+      hist.sumy[v] += ys[i++];
+    });
+}
+
 void TreeRegressor::getBestSplitFromHistogram(
   const TreeRegressor::Histogram& hist,
   int* idx,
+  bool* missingLeft,
   double* gain) {
 
   // The loss function should really be
@@ -96,23 +168,108 @@ void TreeRegressor::getBestSplitFromHistogram(
   // Since the first term (sum of squares of all y-values) is independent
   // of our choice of where to split, it makes no difference, so we ignore it
   // in calculating loss.
+  //
+  // Observations missing the feature are tried on either side of each
+  // split; past the last bucket, the split separates them from the rest.
 
   // loss function if we don't split at all
   double lossBefore = -1.0 * hist.totalSum * hist.totalSum / hist.totalCnt;
 
+  CHECK(hist.num >= 2);
+  const int numBuckets = hist.num - 1;  // buckets of non-missing values
+  const int cntMissing = hist.cnt[numBuckets];
+  const double sumMissing = hist.sumy[numBuckets];
+
   int cntLeft = 0;       // number of observations on or to left of idx
   double sumLeft = 0.0;  // number of observations strictly to right of idx
 
   double bestGain = 0.0;
   int bestIdx = -1;      // everything strictly to right of idx
+  bool bestMissingLeft = false;
 
-  CHECK(hist.num >= 1);
-
-  for (int i = 0; i < hist.num - 1; i++) {
+  const int last = (cntMissing > 0) ? numBuckets : numBuckets - 1;
+  for (int i = 0; i < last; i++) {
 
     cntLeft += hist.cnt[i];
     sumLeft += hist.sumy[i];
 
+    if (hist.totalCnt - cntLeft < FLAGS_min_leaf_examples) {
+      break;
+    }
+
+    // missing values right, then left unless nothing would be right
+    const int numSides = (cntMissing > 0 && i < numBuckets - 1) ? 2 : 1;
+    for (int side = 0; side < numSides; side++) {
+      const int cntL = cntLeft + (side ? cntMissing : 0);
+      const double sumL = sumLeft + (side ? sumMissing : 0.0);
+      const int cntRight = hist.totalCnt - cntL;
+      const double sumRight = hist.totalSum - sumL;
+
+      if (cntL < FLAGS_min_leaf_examples
+          || cntRight < FLAGS_min_leaf_examples) {
+        continue;
+      }
+
+      double lossAfter =
+        -1.0 * sumL * sumL / cntL
+        - 1.0 * sumRight * sumRight / cntRight;
+
+      double gain = lossBefore - lossAfter;
+      if (gain > bestGain) {
+        bestGain = gain;
+        bestIdx = i;
+        bestMissingLeft = (side == 1);
+      }
+    }
+  }
+
+  *idx = bestIdx;
+  *missingLeft = bestMissingLeft;
+  *gain = bestGain;
+}
+
+void TreeRegressor::getBestCategorySplitFromHistogram(
+  const TreeRegressor::Histogram& hist,
+  vector<uint64_t>* categories,
+  bool* missingLeft,
+  double* gain) {
+
+  // Sort the buckets by mean y-value, then split them in that order as for
+  // a numerical feature: for the sum-of-squares error, the best partition
+  // of the categories is one of those (Fisher, 1958). The bucket of other
+  // categories stays on the right, so do categories unseen in training.
+
+  // loss function if we don't split at all
+  double lossBefore = -1.0 * hist.totalSum * hist.totalSum / hist.totalCnt;
+
+  CHECK(hist.num >= 2);
+  const int otherBucket = hist.num - 2;
+  const int missingBucket = hist.num - 1;
+
+  vector<int> buckets;
+  for (int i = 0; i < hist.num; i++) {
+    if (i != otherBucket && hist.cnt[i] > 0) {
+      buckets.push_back(i);
+    }
+  }
+  sort(buckets.begin(), buckets.end(), [&hist](int x, int y) {
+      return hist.sumy[x] / hist.cnt[x] < hist.sumy[y] / hist.cnt[y];
+    });
+
+  int cntLeft = 0;       // number of observations in buckets[0..i]
+  double sumLeft = 0.0;  // sum of their y-values
+
+  double bestGain = 0.0;
+  int bestEnd = -1;      // buckets[0..bestEnd] go left
+
+  // without other categories, the last bucket has to go right
+  const int last = (hist.cnt[otherBucket] > 0)
+    ? buckets.size() : int(buckets.size()) - 1;
+  for (int i = 0; i < last; i++) {
+
+    cntLeft += hist.cnt[buckets[i]];
+    sumLeft += hist.sumy[buckets[i]];
+
     double sumRight = hist.totalSum - sumLeft;
     int cntRight = hist.totalCnt - cntLeft;
 
@@ -130,72 +287,321 @@ void TreeRegressor::getBestSplitFromHistogram(
     double gain = lossBefore - lossAfter;
     if (gain > bestGain) {
       bestGain = gain;
-      bestIdx = i;
+      bestEnd = i;
     }
   }
 
-  *idx = bestIdx;
+  categories->clear();
+  *missingLeft = false;
+  if (bestEnd >= 0) {
+    categories->assign((hist.num + 63) / 64, 0);
+    for (int i = 0; i <= bestEnd; i++) {
+      addCategory(categories, buckets[i]);
+      *missingLeft |= (buckets[i] == missingBucket);
+    }
+  }
   *gain = bestGain;
 }
 
+void TreeRegressor::getBestSplitFromCoarseHistogram(
+  const vector<int>& subset,
+  const vector<double>& ys,
+  const vector<uint16_t>& fvec,
+  const int numBuckets,
+  const double totalSum,
+  int* idx,
+  bool* missingLeft,
+  double* gain) {
+
+  // at most kCoarseBuckets coarse buckets of 2^shift fine buckets each,
+  // plus the missing bucket
+  const int kCoarseBuckets = 256;
+  const int missingBucket = numBuckets - 1;
+  int shift = 0;
+  while (((missingBucket - 1) >> shift) + 1 > kCoarseBuckets) {
+    shift++;
+  }
+  const int numCoarse = ((missingBucket - 1) >> shift) + 1;
+
+  Histogram coarse(numCoarse + 1, subset.size(), totalSum);
+  for (size_t i = 0; i < subset.size(); i++) {
+    const uint16_t v = fvec[subset[i]];
+    const int c = (v == missingBucket) ? numCoarse : (v >> shift);
+    coarse.cnt[c] += 1;
+    coarse.sumy[c] += ys[i];
+  }
+
+  // gain of splitting after each coarse bucket, with the missing values on
+  // their better side
+  const double lossBefore = -1.0 * totalSum * totalSum / coarse.totalCnt;
+  vector<pair<double, int>> gains;
+  int cntLeft = 0;
+  double sumLeft = 0.0;
+  for (int c = 0; c < numCoarse - 1; c++) {
+    cntLeft += coarse.cnt[c];
+    sumLeft += coarse.sumy[c];
+
+    double bestGain = 0.0;
+    for (int side = 0; side < 2; side++) {
+      const int cntL = cntLeft + (side ? coarse.cnt[numCoarse] : 0);
+      const double sumL = sumLeft + (side ? coarse.sumy[numCoarse] : 0.0);
+      const int cntRight = coarse.totalCnt - cntL;
+      const double sumRight = totalSum - sumL;
+      if (cntL < FLAGS_min_leaf_examples
+          || cntRight < FLAGS_min_leaf_examples) {
+        continue;
+      }
+      const double lossAfter =
+        -1.0 * sumL * sumL / cntL - 1.0 * sumRight * sumRight / cntRight;
+      bestGain = max(bestGain, lossBefore - lossAfter);
+    }
+    if (bestGain > 0.0) {
+      gains.emplace_back(bestGain, c);
+    }
+  }
+  const int numCandidates =
+    min<int>(gains.size(), FLAGS_coarse_histogram_candidates);
+  partial_sort(gains.begin(), gains.begin() + numCandidates, gains.end(),
+               greater<pair<double, int>>());
+
+  vector<bool> refined(numCoarse + 1, false);
+  for (int i = 0; i < numCandidates; i++) {
+    refined[gains[i].second] = true;
+    refined[gains[i].second + 1] = true;
+  }
+
+  // The refined histogram has one bucket per fine bucket of the refined
+  // coarse buckets, and one per other coarse bucket; ends[i] is the last
+  // fine bucket in bucket i, and first[c] the first bucket of coarse
+  // bucket c if refined, -1 otherwise.
+  vector<int> ends;
+  vector<int> first(numCoarse + 1, -1);
+  for (int c = 0; c < numCoarse; c++) {
+    const int begin = c << shift;
+    const int end = min(missingBucket, (c + 1) << shift);
+    if (refined[c]) {
+      first[c] = ends.size();
+      for (int v = begin; v < end; v++) {
+        ends.push_back(v);
+      }
+    } else {
+      ends.push_back(end - 1);
+    }
+  }
+  ends.push_back(missingBucket);
+
+  Histogram hist(ends.size(), subset.size(), totalSum);
+  for (int c = 0, i = 0; c <= numCoarse; c++) {
+    if (refined[c]) {
+      i += min(missingBucket, (c + 1) << shift) - (c << shift);
+    } else {
+      hist.cnt[i] = coarse.cnt[c];
+      hist.sumy[i] = coarse.sumy[c];
+      i++;
+    }
+  }
+  if (numCandidates > 0) {
+    for (size_t j = 0; j < subset.size(); j++) {
+      const uint16_t v = fvec[subset[j]];
+      const int c = (v == missingBucket) ? numCoarse : (v >> shift);
+      if (first[c] >= 0) {
+        const int i = first[c] + (v & ((1 << shift) - 1));
+        hist.cnt[i] += 1;
+        hist.sumy[i] += ys[j];
+      }
+    }
+  }
+
+  getBestSplitFromHistogram(hist, idx, missingLeft, gain);
+  if (*idx >= 0) {
+    *idx = ends[*idx];
+  }
+}
+
+void TreeRegressor::buildRowHistograms(
+  const vector<int>& subset,
+  const vector<double>& ys,
+  const vector<int>& fids,
+  const double totalSum,
+  vector<unique_ptr<Histogram>>* hists) const {
+
+  // The columns of a node with a small fraction of the examples are read
+  // one cache line per example and feature, while going row by row reads
+  // a few lines per example, but updates all the histograms at once: that
+  // only pays off below about 1 in 32 examples (2x faster at 1 in 100).
+  const int kMinSparsity = 32;
+  if (subset.size() * kMinSparsity >= ds_.getNumExamples()) {
+    return;
+  }
+  vector<int> columns;
+  for (int fid : fids) {
+    if (ds_.rowByteColumns_[fid] >= 0) {
+      columns.push_back(fid);
+    }
+  }
+  const int width = ds_.rowByteWidth_;
+  // with few sampled columns, reading them costs fewer cache lines per
+  // example than reading the whole row
+  const int linesPerRow = (width + 63) / 64;
+  if (columns.empty() || columns.size() < linesPerRow) {
+    return;
+  }
+
+  hists->resize(ds_.numFeatures_);
+  vector<const uint8_t*> offsets;
+  vector<int*> cnts;
+  vector<double*> sumys;
+  for (int fid : columns) {
+    Histogram* hist = new Histogram(ds_.features_[fid].transitions.size() + 2,
+                                    subset.size(), totalSum);
+    (*hists)[fid].reset(hist);
+    offsets.push_back(ds_.rowBytes_.data() + ds_.rowByteColumns_[fid]);
+    cnts.push_back(hist->cnt.data());
+    sumys.push_back(hist->sumy.data());
+  }
+
+  const int numColumns = columns.size();
+  for (size_t i = 0; i < subset.size(); i++) {
+    const size_t row = size_t(subset[i]) * width;
+    const double y = ys[i];
+    for (int k = 0; k < numColumns; k++) {
+      const uint8_t v = offsets[k][row];
+      cnts[k][v] += 1;
+      sumys[k][v] += y;
+    }
+  }
+}
+
+void TreeRegressor::getBestFeatureSplit(
+  int fid,
+  const vector<int>& subset,
+  const vector<double>& ys,
+  const double totalSum,
+  const Histogram* rowHist,
+  int* fv,
+  bool* missingLeft,
+  vector<uint64_t>* categories,
+  double* gain) const {
+
+  const auto& f = ds_.features_[fid];
+  const int numBuckets = f.transitions.size() + 2;
+
+  // zeroing and scanning a dense histogram much bigger than the node
+  // costs more than two passes over the node
+  if (f.encoding == SHORT && !f.categorical
+      && subset.size() < FLAGS_coarse_histogram_max_density * numBuckets) {
+    categories->clear();
+    getBestSplitFromCoarseHistogram(subset, ys, *(f.svec), numBuckets,
+                                    totalSum, fv, missingLeft, gain);
+    return;
+  }
+
+  unique_ptr<Histogram> colHist;
+  if (rowHist == NULL) {
+    colHist.reset(new Histogram(numBuckets, subset.size(), totalSum));
+    if (f.encoding == BYTE) {
+      buildHistogram<uint8_t>(subset, ys, *(f.bvec), *colHist);
+    } else if (f.encoding == PACKED) {
+      buildHistogram(subset, ys, *(f.pvec), *colHist);
+    } else {
+      CHECK(f.encoding == SHORT);
+      buildHistogram<uint16_t>(subset, ys, *(f.svec), *colHist);
+    }
+  }
+  const Histogram& hist = rowHist ? *rowHist : *colHist;
+
+  if (f.categorical) {
+    getBestCategorySplitFromHistogram(hist, categories, missingLeft, gain);
+  } else {
+    categories->clear();
+    getBestSplitFromHistogram(hist, fv, missingLeft, gain);
+  }
+}
+
 TreeRegressor::SplitNode*
 TreeRegressor::getBestSplit(const vector<int>* subset,
+                            const vector<double>* ys,
+                            int depth,
                             double featureSamplingRate,
                             bool terminal) {
 
-  SplitNode* split = new SplitNode(subset);
-  if (terminal) {
+  SplitNode* split = new SplitNode(subset, ys, depth);
+  if (terminal || (FLAGS_max_depth >= 0 && depth >= FLAGS_max_depth)) {
     allSplits_.push_back(split);
     return split;
   }
 
   int bestFid = -1;       // which feature to split on, -1 is invalid
   int bestFv = 0;         // critical value of that feature
+  bool bestMissingLeft = false;
+  vector<uint64_t> bestCategories;  // buckets going left, if categorical
+  vector<uint64_t> categories;
 
   // gain in prediction accuracy from that split:
   // initialize to 0 instead of std::numeric_limits<double>::lowest() because,
   // if no split results in a positive gain, we would rather report that, than
-  // return a valid but degenerate split
+  // return a valid but degenerate split. Splits are ranked by their score,
+  // the gain less the serving cost of a feature not used yet; fimps get
+  // the gain itself.
+  double bestScore = 0.0;
   double bestGain = 0.0;
 
   double totalSum = 0.0;  // sum of all target values
 
-  for (auto& id : *subset) {
-    totalSum += y_[id];
+  for (auto y : *ys) {
+    totalSum += y;
   }
 
-  // For each of a random sampling of features, see if splitting on that
-  // feature results in the biggest improvement so far.
-  // TODO(tiankai): The various fid's can be processed in parallel.
+  // a random sampling of features
+  vector<int> fids;
   for (int fid = 0; fid < ds_.numFeatures_; fid++) {
-    const auto& f = ds_.features_[fid];
-
-    if (f.encoding == EMPTY || !biasedCoinFlip(featureSamplingRate)) {
-      continue;
+    if (ds_.features_[fid].encoding != EMPTY
+        && biasedCoinFlip(featureSamplingRate)) {
+      fids.push_back(fid);
     }
+  }
 
-    Histogram hist(f.transitions.size() + 1, subset->size(), totalSum);
-
-    if (f.encoding == BYTE) {
-      buildHistogram<uint8_t>(*subset, *(f.bvec), hist);
-    } else {
-      CHECK(f.encoding == SHORT);
-      buildHistogram<uint16_t>(*subset, *(f.svec), hist);
-    }
+  // histograms of the byte features built row by row, if any
+  vector<unique_ptr<Histogram>> rowHists;
+  if (!ds_.rowBytes_.empty()) {
+    buildRowHistograms(*subset, *ys, fids, totalSum, &rowHists);
+  }
 
-    int fv;
+  // For each of the features, see if splitting on that feature results in
+  // the biggest improvement so far.
+  // TODO(tiankai): The various fid's can be processed in parallel.
+  split->featureGains.assign(ds_.numFeatures_,
+                             numeric_limits<double>::lowest());
+  for (int fid : fids) {
+    int fv = 0;
+    bool missingLeft;
     double gain;
-    getBestSplitFromHistogram(hist, &fv, &gain);
+    getBestFeatureSplit(fid, *subset, *ys, totalSum,
+                        rowHists.empty() ? NULL : rowHists[fid].get(),
+                        &fv, &missingLeft, &categories, &gain);
+    split->featureGains[fid] = gain;
+
+    // a feature not used yet must pay for its serving cost
+    double score = gain;
+    if (!usedFeatures_[fid]) {
+      score -= ds_.cfg_.getFeatureCost(fid) * subset->size();
+    }
 
-    if (gain > bestGain) {
+    if (score > bestScore) {
       bestFid = fid;
       bestFv = fv;
+      bestMissingLeft = missingLeft;
+      bestCategories.swap(categories);
+      bestScore = score;
       bestGain = gain;
     }
   }
   split->fid = bestFid;
   split->fv = bestFv;
+  split->missingLeft = bestMissingLeft;
+  split->categories.swap(bestCategories);
   split->gain = bestGain;
+  split->score = bestScore;
 
   frontiers_.push_back(split);
   allSplits_.push_back(split);
@@ -218,13 +624,67 @@ TreeNode<uint16_t>* TreeRegressor::getTree(
   }
   CHECK(subset->size() >= FLAGS_min_leaf_examples * numLeaves);
 
+  vector<double>* ys = new vector<double>();
+  ys->reserve(subset->size());
+  for (auto id : *subset) {
+    ys->push_back(y_[id]);
+  }
+
+  usedFeatures_.assign(ds_.numFeatures_, false);
+  if (!ds_.cfg_.isFeatureCostPerTree()) {
+    for (int fid = 0; fid < ds_.numFeatures_; fid++) {
+      usedFeatures_[fid] = (fimps[fid] > 0.0);
+    }
+  }
+
   // compute the decision tree in SplitNode's
-  SplitNode* root = getBestSplits(subset, numLeaves - 1, featureSamplingRate);
+  SplitNode* root =
+    getBestSplits(subset, ys, numLeaves - 1, featureSamplingRate);
+
+  // the votes of all the nodes, computed in parallel since they may take
+  // more than a pass over the examples of each node
+  parallelForBlocks(allSplits_.size(), 1, [this](int i, int begin, int end) {
+      allSplits_[i]->vote = fun_.getLeafVal(*(allSplits_[i]->subset), y_);
+    });
 
   // convert the decision tree to PartitionNode's and LeafNode's
   return getTreeHelper(root, fimps);
 }
 
+void TreeRegressor::useFeature(int fid) {
+  if (usedFeatures_[fid]) {
+    return;
+  }
+  usedFeatures_[fid] = true;
+  if (ds_.cfg_.getFeatureCost(fid) == 0.0) {
+    return;
+  }
+
+  for (SplitNode* split : frontiers_) {
+    if (split->fid == fid) {
+      split->score = split->gain;
+    } else if (split->featureGains[fid] > split->score) {
+      // the split lost to another feature, or to none, only for the cost
+      double totalSum = 0.0;
+      for (auto y : *(split->ys)) {
+        totalSum += y;
+      }
+      int fv = 0;
+      bool missingLeft;
+      vector<uint64_t> categories;
+      double gain;
+      getBestFeatureSplit(fid, *(split->subset), *(split->ys), totalSum, NULL,
+                          &fv, &missingLeft, &categories, &gain);
+      split->fid = fid;
+      split->fv = fv;
+      split->missingLeft = missingLeft;
+      split->categories.swap(categories);
+      split->gain = gain;
+      split->score = gain;
+    }
+  }
+}
+
 TreeNode<uint16_t>* TreeRegressor::getTreeHelper(
   SplitNode* split,
   double fimps[]) {
@@ -233,50 +693,74 @@ TreeNode<uint16_t>* TreeRegressor::getTreeHelper(
     return NULL;
   } else if (!split->selected) {
     // leaf of decision tree
-    double fvote = fun_.getLeafVal(*(split->subset), y_);
+    double fvote = split->vote;
     LOG(INFO) << "leaf:  " << fvote << ", #examples:"
               << split->subset->size();
     CHECK(split->subset->size() >= FLAGS_min_leaf_examples);
 
-    return new LeafNode<uint16_t>(fvote);
+    LeafNode<uint16_t>* node = new LeafNode<uint16_t>(fvote);
+    node->setCount(split->subset->size());
+    return node;
   } else {
     // internal node of decision tree
     LOG(INFO) << "select split: " << split->fid << ":" << split->fv
+              << (split->categories.empty() ? "" : " categorical")
+              << (split->missingLeft ? " missing left" : "")
               << " gain: " << split->gain << ", #examples:"
               << split->subset->size() << ", min partition: "
               << std::min(split->left->subset->size(), split->right->subset->size());
 
     fimps[split->fid] += split->gain;
-    double fvote = fun_.getLeafVal(*(split->subset), y_);
+    double fvote = split->vote;
     PartitionNode<uint16_t>* node = new PartitionNode<uint16_t>(split->fid, split->fv);
+    node->setMissingLeft(split->missingLeft);
+    if (!split->categories.empty()) {
+      node->setCategories(CategorySet(split->categories));
+    }
     node->setLeft(getTreeHelper(split->left, fimps));
     node->setRight(getTreeHelper(split->right, fimps));
     node->setVote(fvote);
+    node->setCount(split->subset->size());
 
     return node;
   }
 }
 
 TreeRegressor::SplitNode* TreeRegressor::getBestSplits(
-  const vector<int>* subset, const int numSplits, double featureSamplingRate) {
+  const vector<int>* subset,
+  const vector<double>* ys,
+  const int numSplits,
+  double featureSamplingRate) {
 
   CHECK(subset != NULL);
 
   // Compute the root of the decision tree.
-  SplitNode* firstSplit = getBestSplit(subset, featureSamplingRate, false);
+  SplitNode* firstSplit =
+    getBestSplit(subset, ys, 0, featureSamplingRate, false);
+
+  // expected number of comparisons per row: each split is evaluated by the
+  // fraction of rows reaching it
+  const double numExamples = subset->size();
+  double comparisons = 0.0;
 
   int numSelected = 0;
   do {
-    // frontiers_.size() = #leaves = #internal nodes + 1 = numSelected + 1
-    CHECK(frontiers_.size() == numSelected+1);
+    // frontiers_ holds the leaves that may still be split, i.e. all of the
+    // numSelected + 1 leaves but those at max_depth
+    CHECK(frontiers_.size() <= numSelected+1);
 
-    // Do a linear search over the leaves to find the next split with the most
-    // gain.
-    double bestGain = 0.0;
+    // Do a linear search over the leaves to find the next split with the
+    // best score, within the budget of comparisons.
+    double bestScore = 0.0;
     vector<SplitNode*>::iterator best_it = frontiers_.end();
     for (auto it = frontiers_.begin(); it != frontiers_.end(); it++) {
-      if ((*it)->gain > bestGain) {
-        bestGain = (*it)->gain;
+      if (FLAGS_max_expected_comparisons >= 0.0
+          && comparisons + (*it)->subset->size() / numExamples
+             > FLAGS_max_expected_comparisons) {
+        continue;
+      }
+      if ((*it)->score > bestScore) {
+        bestScore = (*it)->score;
         best_it = it;
       }
     }
@@ -286,22 +770,34 @@ TreeRegressor::SplitNode* TreeRegressor::getBestSplits(
       break;
     }
 
-    CHECK(bestGain > 0.0);
+    CHECK(bestScore > 0.0);
 
     (*best_it)->selected = true;
     numSelected++;
     SplitNode* bestSplit = *best_it;
     frontiers_.erase(best_it);
+    comparisons += bestSplit->subset->size() / numExamples;
+    vector<double>().swap(bestSplit->featureGains);
+    useFeature(bestSplit->fid);
 
     // Now that we've selected bestSplit, expand its left and right children.
     vector<int>* left = new vector<int>();
     vector<int>* right = new vector<int>();
 
     splitExamples(*bestSplit, left, right);
+    vector<double>* leftYs = new vector<double>();
+    vector<double>* rightYs = new vector<double>();
+    splitValues(*(bestSplit->subset), *(bestSplit->ys), *left,
+                leftYs, rightYs);
+    delete bestSplit->ys;
+    bestSplit->ys = NULL;
     bool terminal = (numSelected == numSplits);
 
-    bestSplit->left = getBestSplit(left, featureSamplingRate, terminal);
-    bestSplit->right = getBestSplit(right, featureSamplingRate, terminal);
+    const int depth = bestSplit->depth + 1;
+    bestSplit->left =
+      getBestSplit(left, leftYs, depth, featureSamplingRate, terminal);
+    bestSplit->right =
+      getBestSplit(right, rightYs, depth, featureSamplingRate, terminal);
   } while (numSelected < numSplits);
 
   return firstSplit;
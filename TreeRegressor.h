@@ -20,12 +20,14 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <boost/scoped_array.hpp>
 
 namespace boosting {
 
 class DataSet;
+class PackedVector;
 template<class T> class TreeNode;
 class GbmFun;
 
@@ -39,7 +41,8 @@ class TreeRegressor {
   // Return the root of a regression tree with desired specifications, based on
   // a random sampling of the data in ds_ and a random sampling of the features.
   // Also set the feature importance vector (fimps) = total gains from
-  // splitting along each feature (most entries will be 0).
+  // splitting along each feature (most entries will be 0). Features with
+  // fimps > 0 count as already used by the model for feature costs.
   TreeNode<uint16_t>* getTree(
     const int numLeaves,
     const double exampleSamplingRate,
@@ -54,12 +57,26 @@ class TreeRegressor {
   // (given by subset); responsible for cleaning up subset upon destruction
   struct SplitNode {
 
-    explicit SplitNode(const std::vector<int>* subset);
+    SplitNode(const std::vector<int>* subset,
+              const std::vector<double>* ys,
+              int depth);
 
     const std::vector<int>* subset;  // which subset of the data we're using
+    // y-values of subset, in the same order, so that building histograms
+    // reads them sequentially; released once the children are computed
+    const std::vector<double>* ys;
+    int depth;      // depth in the regression tree, 0 for the root
     int fid;        // which feature to split along
     uint16_t fv;    // value of said feature, at which to split
+    bool missingLeft;  // whether examples missing the feature go left
+    std::vector<uint64_t> categories;  // buckets going left, if categorical
     double gain;    // gain in prediction accuracy from this split
+    double score;   // gain less the feature cost, ranks the splits
+    // gain of the best split along each sampled feature, lowest() for the
+    // others, to re-score the node when a feature gets used (see
+    // useFeature); released once the node is selected
+    std::vector<double> featureGains;
+    double vote;    // prediction for the subset, see GbmFun::getLeafVal
     bool selected;  // internal node of regression tree, as opposed to leaf
 
     SplitNode* left;   // left child in a regression tree
@@ -67,6 +84,7 @@ class TreeRegressor {
 
     ~SplitNode() {
       delete subset;
+      delete ys;
     }
   };
 
@@ -74,7 +92,8 @@ class TreeRegressor {
   // data has two dimensions. Make buckets based on the x-dimension,
   // and within each bucket keep track of not only the number of
   // observations (as in a basic histogram), but also the sum of y-values
-  // of those observations.
+  // of those observations. The last bucket holds the observations
+  // missing the feature (see FeatureData::getMissingBucket).
   struct Histogram {
     const int num;             // number of buckets
     std::vector<int> cnt;      // number of observations in each bucket
@@ -92,36 +111,107 @@ class TreeRegressor {
   };
 
   template<class T>
-    void buildHistogram(const std::vector<int>& subset,
-                        const std::vector<T>& fvec,
-                        Histogram& hist) const;
+    static void buildHistogram(const std::vector<int>& subset,
+                               const std::vector<double>& ys,
+                               const std::vector<T>& fvec,
+                               Histogram& hist);
+
+  static void buildHistogram(const std::vector<int>& subset,
+                             const std::vector<double>& ys,
+                             const PackedVector& fvec,
+                             Histogram& hist);
+
+  // Build the histograms of the byte features among fids from the row-major
+  // copy of the data set, in a single pass over the rows of subset, into
+  // hists indexed by feature id. Leaves hists empty for nodes too big for
+  // that to be faster than reading the columns one by one.
+  void buildRowHistograms(const std::vector<int>& subset,
+                          const std::vector<double>& ys,
+                          const std::vector<int>& fids,
+                          const double totalSum,
+                          std::vector<std::unique_ptr<Histogram>>* hists) const;
 
   // Choose the x-value such that, by splitting the data at that value, we
-  // minimize the total sum-of-squares error
+  // minimize the total sum-of-squares error, and the side the observations
+  // missing the feature go to
   static void getBestSplitFromHistogram(
     const TreeRegressor::Histogram& hist,
     int* idx,
+    bool* missingLeft,
     double* gain);
 
-  // Based on a sampling of the data (given by *subset) and a random sampling
-  // of features (given by featureSamplingRate), find a splitting that maximizes
-  // prediction accuracy, unless terminal==true, in which case just return a
-  // sentry.
+  // Same for a categorical feature: choose the set of buckets going left,
+  // as a bitset, the bucket of other categories always going right
+  static void getBestCategorySplitFromHistogram(
+    const TreeRegressor::Histogram& hist,
+    std::vector<uint64_t>* categories,
+    bool* missingLeft,
+    double* gain);
+
+  // Same as building the histogram of a numerical feature with numBuckets
+  // buckets then getBestSplitFromHistogram, for features with many buckets:
+  // the dense histogram is too big to stay in cache, so build a coarse one
+  // first, then the fine buckets only within the coarse buckets around the
+  // best coarse splits. Splits inside the other coarse buckets are skipped.
+  static void getBestSplitFromCoarseHistogram(
+    const std::vector<int>& subset,
+    const std::vector<double>& ys,
+    const std::vector<uint16_t>& fvec,
+    const int numBuckets,
+    const double totalSum,
+    int* idx,
+    bool* missingLeft,
+    double* gain);
+
+  // Find the best split of subset along feature fid, from rowHist if it is
+  // the histogram of fid built by buildRowHistograms, or else from the
+  // column of fid
+  void getBestFeatureSplit(int fid,
+                           const std::vector<int>& subset,
+                           const std::vector<double>& ys,
+                           const double totalSum,
+                           const Histogram* rowHist,
+                           int* fv,
+                           bool* missingLeft,
+                           std::vector<uint64_t>* categories,
+                           double* gain) const;
+
+  // Based on a sampling of the data (given by *subset, with y-values *ys) and
+  // a random sampling of features (given by featureSamplingRate), find a
+  // splitting that maximizes prediction accuracy, unless terminal==true or
+  // depth reaches max_depth, in which case just return a sentry.
   // Upon finish, also push to working queues (frontiers_ and allSplits_)
   SplitNode* getBestSplit(const std::vector<int>* subset,
+                          const std::vector<double>* ys,
+                          int depth,
                           double featureSamplingRate,
                           bool terminal);
 
+  // Mark fid as used by the tree: the frontier splits along it stop paying
+  // its cost, and those that lost to another feature, or found no split,
+  // only because of its cost are split along it instead
+  void useFeature(int fid);
+
   // Partition split.subset into left and right according to the splitting
   // specified by split.fid and split.fv
   void splitExamples(const SplitNode& split,
                      std::vector<int>* left,
                      std::vector<int>* right);
 
+  // Partition the y-values ys of subset along with it, given the examples
+  // going left: left is a subsequence of subset
+  static void splitValues(const std::vector<int>& subset,
+                          const std::vector<double>& ys,
+                          const std::vector<int>& left,
+                          std::vector<double>* leftYs,
+                          std::vector<double>* rightYs);
+
   // Return root of a regression tree for data in subset with numSplits internal
   // nodes (i.e., numSplits+1 leaves) by greedily selecting the splits with the
-  // biggest gain.
+  // biggest gain. Splits that would make the expected number of comparisons
+  // per row exceed max_expected_comparisons are skipped.
   SplitNode* getBestSplits(const std::vector<int>* subset,
+                           const std::vector<double>* ys,
                            const int numSplits,
                            double featureSamplingRate);
 
@@ -135,6 +225,10 @@ class TreeRegressor {
   const boost::scoped_array<double>& y_;
   const GbmFun& fun_;
 
+  // features used by the model (or the tree, see
+  // Config::isFeatureCostPerTree), which split without paying their cost
+  std::vector<bool> usedFeatures_;
+
   // working queue to select best numSplits splits
   // could replace with priority queue if necessary
   std::vector<SplitNode*> frontiers_;
@@ -146,14 +240,15 @@ class TreeRegressor {
 
 template<class T>
   void TreeRegressor::buildHistogram(const std::vector<int>& subset,
+                                     const std::vector<double>& ys,
                                      const std::vector<T>& fvec,
-                                     Histogram& hist) const {
+                                     Histogram& hist) {
 
-  for(auto id : subset) {
-    const T& v = fvec[id];
+  for (size_t i = 0; i < subset.size(); i++) {
+    const T& v = fvec[subset[i]];
 
     hist.cnt[v] += 1;
-    hist.sumy[v] += y_[id];
+    hist.sumy[v] += ys[i];
   }
 }
 